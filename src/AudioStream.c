@@ -3,11 +3,16 @@
 #include "PlatformThreads.h"
 #include "LinkedBlockingQueue.h"
 #include "RtpReorderQueue.h"
+#include "RtpAudioFecQueue.h"
+#include "RtpClockDrift.h"
+#include "RtpReactor.h"
 
 static SOCKET rtpSocket = INVALID_SOCKET;
 
 static LINKED_BLOCKING_QUEUE packetQueue;
 static RTP_REORDER_QUEUE rtpReorderQueue;
+static RTP_AUDIO_FEC_QUEUE audioFecQueue;
+static RTP_CLOCK_DRIFT clockDrift;
 
 static PLT_THREAD udpPingThread;
 static PLT_THREAD receiveThread;
@@ -16,10 +21,32 @@ static PLT_THREAD decoderThread;
 static unsigned short lastSeq;
 
 static int receivedDataFromPeer;
+static int waitingForAudioMs;
+static int packetsToDrop;
+
+// Latency control state. The target is updated by the receive thread from
+// the measured jitter and read by the decoder thread.
+static volatile int targetLatencyMs;
+static uint64_t overTargetSinceMs;
+static int packetsSinceTrim;
+
+static RTP_REACTOR_HANDLER reactorHandler;
 
 #define RTP_PORT 48000
 
-#define MAX_PACKET_SIZE 1400
+#define MAX_PACKET_SIZE RTPA_MAX_PACKET_SIZE
+
+// The decode queue is steered back toward this much audio, plus an
+// allowance for the measured arrival jitter
+#define AUDIO_TARGET_LATENCY_MS 30
+#define AUDIO_JITTER_MULTIPLIER 2
+
+// The decode queue must stay above the target for this long before we
+// start trimming, so brief bursts don't cause audible drops
+#define AUDIO_TRIM_HOLD_MS 500
+
+// While trimming, drop at most one of this many packets
+#define AUDIO_TRIM_INTERVAL 4
 
 // This is much larger than we should typically have buffered, but
 // it needs to be. We need a cushion in case our thread gets blocked
@@ -37,12 +64,78 @@ typedef struct _QUEUED_AUDIO_PACKET {
     } q;
 } QUEUED_AUDIO_PACKET, *PQUEUED_AUDIO_PACKET;
 
+#define AUDIO_PACKET_QUEUE_BOUND 30
+
+// Enough packets to fill the reorder queue and the LBQ with some to spare
+// for the receive buffer, FEC recovery, and the packet being decoded
+#define AUDIO_PACKET_POOL_SIZE (RTPQ_DEFAULT_MAX_SIZE + AUDIO_PACKET_QUEUE_BOUND + 4)
+
+// All audio packets come from this pool rather than the heap. The receive
+// thread takes packets and the decoder returns them once they're played.
+static QUEUED_AUDIO_PACKET packetPool[AUDIO_PACKET_POOL_SIZE];
+static PQUEUED_AUDIO_PACKET freePackets[AUDIO_PACKET_POOL_SIZE];
+static int freePacketCount;
+static PLT_MUTEX packetPoolMutex;
+
+// Receive buffer not yet owned by the reorder queue or LBQ
+static PQUEUED_AUDIO_PACKET receivePacket;
+
+static int initializePacketPool(void) {
+    int i;
+
+    for (i = 0; i < AUDIO_PACKET_POOL_SIZE; i++) {
+        freePackets[i] = &packetPool[i];
+    }
+    freePacketCount = AUDIO_PACKET_POOL_SIZE;
+
+    return PltCreateMutex(&packetPoolMutex);
+}
+
+// Returns NULL if all packets are in use
+static PQUEUED_AUDIO_PACKET allocateAudioPacket(void) {
+    PQUEUED_AUDIO_PACKET packet;
+
+    PltLockMutex(&packetPoolMutex);
+    packet = freePacketCount > 0 ? freePackets[--freePacketCount] : NULL;
+    PltUnlockMutex(&packetPoolMutex);
+
+    return packet;
+}
+
+static void freeAudioPacket(PQUEUED_AUDIO_PACKET packet) {
+    PltLockMutex(&packetPoolMutex);
+    LC_ASSERT(freePacketCount < AUDIO_PACKET_POOL_SIZE);
+    freePackets[freePacketCount++] = packet;
+    PltUnlockMutex(&packetPoolMutex);
+}
+
 // Initialize the audio stream
-void initializeAudioStream(void) {
-    LbqInitializeLinkedBlockingQueue(&packetQueue, 30);
+int initializeAudioStream(void) {
+    int err;
+
+    err = initializePacketPool();
+    if (err != 0) {
+        return err;
+    }
+
+    err = LbqInitializeLinkedBlockingQueue(&packetQueue, AUDIO_PACKET_QUEUE_BOUND);
+    if (err != 0) {
+        PltDeleteMutex(&packetPoolMutex);
+        return err;
+    }
+
     RtpqInitializeQueue(&rtpReorderQueue, RTPQ_DEFAULT_MAX_SIZE, RTPQ_DEFAULT_QUEUE_TIME);
+    RtpqEnableAdaptiveQueueTime(&rtpReorderQueue, AudioPacketDuration);
+    RtpaInitializeQueue(&audioFecQueue, AudioPacketDuration);
+    RtpdInitialize(&clockDrift, AudioPacketDuration);
     lastSeq = 0;
     receivedDataFromPeer = 0;
+    waitingForAudioMs = 0;
+    targetLatencyMs = AUDIO_TARGET_LATENCY_MS;
+    overTargetSinceMs = 0;
+    packetsSinceTrim = 0;
+
+    return 0;
 }
 
 static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
@@ -51,8 +144,8 @@ static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
     while (entry != NULL) {
         nextEntry = entry->flink;
 
-        // The entry is stored within the data allocation
-        free(entry->data);
+        // The entry is stored within the packet
+        freeAudioPacket((PQUEUED_AUDIO_PACKET)entry->data);
 
         entry = nextEntry;
     }
@@ -62,9 +155,12 @@ static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
 void destroyAudioStream(void) {
     freePacketList(LbqDestroyLinkedBlockingQueue(&packetQueue));
     RtpqCleanupQueue(&rtpReorderQueue);
+    RtpaCleanupQueue(&audioFecQueue);
+    PltDeleteMutex(&packetPoolMutex);
 }
 
-static void UdpPingThreadProc(void* context) {
+// Send a UDP ping to the host so it knows where to send audio
+static int sendAudioPing(void) {
     // Ping in ASCII
     char pingData[] = { 0x50, 0x49, 0x4E, 0x47 };
     struct sockaddr_in6 saddr;
@@ -73,12 +169,20 @@ static void UdpPingThreadProc(void* context) {
     memcpy(&saddr, &RemoteAddr, sizeof(saddr));
     saddr.sin6_port = htons(RTP_PORT);
 
+    err = sendto(rtpSocket, pingData, sizeof(pingData), 0, (struct sockaddr*)&saddr, RemoteAddrLen);
+    if (err != sizeof(pingData)) {
+        Limelog("Audio Ping: sendto() failed: %d\n", (int)LastSocketError());
+        ListenerCallbacks.connectionTerminated(LastSocketFail());
+        return -1;
+    }
+
+    return 0;
+}
+
+static void UdpPingThreadProc(void* context) {
     // Send PING every second until we get data back then every 5 seconds after that.
     while (!PltIsThreadInterrupted(&udpPingThread)) {
-        err = sendto(rtpSocket, pingData, sizeof(pingData), 0, (struct sockaddr*)&saddr, RemoteAddrLen);
-        if (err != sizeof(pingData)) {
-            Limelog("Audio Ping: sendto() failed: %d\n", (int)LastSocketError());
-            ListenerCallbacks.connectionTerminated(LastSocketFail());
+        if (sendAudioPing() < 0) {
             return;
         }
 
@@ -95,8 +199,9 @@ static int queuePacketToLbq(PQUEUED_AUDIO_PACKET* packet) {
         *packet = NULL;
     }
     else if (err == LBQ_BOUND_EXCEEDED) {
+        // Drop only this packet. Flushing the whole queue would cause a
+        // long glitch, and the decoder will trim the excess latency.
         Limelog("Audio packet queue overflow\n");
-        freePacketList(LbqFlushQueueItems(&packetQueue));
     }
     else if (err == LBQ_INTERRUPTED) {
         return 0;
@@ -105,6 +210,47 @@ static int queuePacketToLbq(PQUEUED_AUDIO_PACKET* packet) {
     return 1;
 }
 
+static void updateTargetLatency(void) {
+    int targetMs;
+
+    targetMs = AUDIO_TARGET_LATENCY_MS + AUDIO_JITTER_MULTIPLIER * RtpqGetJitterMs(&rtpReorderQueue);
+
+    // Always allow a couple of packets to be queued
+    if (targetMs < 2 * AudioPacketDuration) {
+        targetMs = 2 * AudioPacketDuration;
+    }
+
+    targetLatencyMs = targetMs;
+}
+
+// Called on the decoder thread for each packet taken from the decode queue.
+// Returns 1 if the packet should be discarded to reduce latency.
+static int shouldTrimAudioPacket(void) {
+    uint64_t now;
+
+    if (LiGetPendingAudioDuration() <= targetLatencyMs) {
+        overTargetSinceMs = 0;
+        packetsSinceTrim = 0;
+        return 0;
+    }
+
+    now = PltGetMillis();
+    if (overTargetSinceMs == 0) {
+        overTargetSinceMs = now;
+        return 0;
+    }
+    else if (now - overTargetSinceMs < AUDIO_TRIM_HOLD_MS) {
+        return 0;
+    }
+
+    if (++packetsSinceTrim < AUDIO_TRIM_INTERVAL) {
+        return 0;
+    }
+
+    packetsSinceTrim = 0;
+    return 1;
+}
+
 static void decodeInputData(PQUEUED_AUDIO_PACKET packet) {
     PRTP_PACKET rtp;
 
@@ -112,7 +258,10 @@ static void decodeInputData(PQUEUED_AUDIO_PACKET packet) {
     if (lastSeq != 0 && (unsigned short)(lastSeq + 1) != rtp->sequenceNumber) {
         Limelog("Received OOS audio data (expected %d, but got %d)\n", lastSeq + 1, rtp->sequenceNumber);
 
-        AudioCallbacks.decodeAndPlaySample(NULL, 0);
+        // Concealment only adds latency if we're already over our target
+        if (LiGetPendingAudioDuration() <= targetLatencyMs) {
+            AudioCallbacks.decodeAndPlaySample(NULL, 0);
+        }
     }
 
     lastSeq = rtp->sequenceNumber;
@@ -120,128 +269,250 @@ static void decodeInputData(PQUEUED_AUDIO_PACKET packet) {
     AudioCallbacks.decodeAndPlaySample((char*)(rtp + 1), packet->size - sizeof(*rtp));
 }
 
-static void ReceiveThreadProc(void* context) {
-    PRTP_PACKET rtp;
+// Passes a packet in host byte order through the reorder queue to the decoder.
+// The packet pointer is set to NULL if ownership of the packet was taken.
+// Returns 0 if an exit signal was received.
+static int queueAudioPacket(PQUEUED_AUDIO_PACKET* packetPtr, uint64_t receiveTimeMs) {
     PQUEUED_AUDIO_PACKET packet;
     int queueStatus;
-    int useSelect;
-    int packetsToDrop = 500 / AudioPacketDuration;
-    int waitingForAudioMs;
 
-    packet = NULL;
-
-    if (setNonFatalRecvTimeoutMs(rtpSocket, UDP_RECV_POLL_TIMEOUT_MS) < 0) {
-        // SO_RCVTIMEO failed, so use select() to wait
-        useSelect = 1;
+    queueStatus = RtpqAddPacket(&rtpReorderQueue, (PRTP_PACKET)*packetPtr, &(*packetPtr)->q.rentry, receiveTimeMs);
+    updateTargetLatency();
+    if (RTPQ_HANDLE_NOW(queueStatus)) {
+        if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+            if (!queuePacketToLbq(packetPtr)) {
+                // An exit signal was received
+                return 0;
+            }
+        }
+        else {
+            decodeInputData(*packetPtr);
+        }
     }
     else {
-        // SO_RCVTIMEO timeout set for recv()
-        useSelect = 0;
+        if (RTPQ_PACKET_CONSUMED(queueStatus)) {
+            // The queue consumed our packet, so we must allocate a new one
+            *packetPtr = NULL;
+        }
+
+        if (RTPQ_PACKET_READY(queueStatus)) {
+            // If packets are ready, pull them and send them to the decoder
+            while ((packet = (PQUEUED_AUDIO_PACKET)RtpqGetQueuedPacket(&rtpReorderQueue)) != NULL) {
+                if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+                    if (!queuePacketToLbq(&packet)) {
+                        // An exit signal was received
+                        freeAudioPacket(packet);
+                        return 0;
+                    }
+
+                    // Free the packet if the LBQ didn't take it
+                    if (packet != NULL) {
+                        freeAudioPacket(packet);
+                    }
+                }
+                else {
+                    decodeInputData(packet);
+                    freeAudioPacket(packet);
+                }
+            }
+        }
     }
 
-    waitingForAudioMs = 0;
-    while (!PltIsThreadInterrupted(&receiveThread)) {
+    return 1;
+}
+
+// Passes packets rebuilt from audio FEC data to the decoder.
+// Returns 0 if an exit signal was received.
+static int queueRecoveredAudioPackets(uint64_t receiveTimeMs) {
+    PQUEUED_AUDIO_PACKET packet;
+
+    packet = NULL;
+    while (RtpaHasRecoveredPackets(&audioFecQueue)) {
         if (packet == NULL) {
-            packet = (PQUEUED_AUDIO_PACKET)malloc(sizeof(*packet));
+            packet = allocateAudioPacket();
             if (packet == NULL) {
-                Limelog("Audio Receive: malloc() failed\n");
-                ListenerCallbacks.connectionTerminated(-1);
+                // Not fatal; the packets will be concealed instead
                 break;
             }
         }
 
-        packet->size = recvUdpSocket(rtpSocket, &packet->data[0], MAX_PACKET_SIZE, useSelect);
-        if (packet->size < 0) {
-            Limelog("Audio Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
-            ListenerCallbacks.connectionTerminated(LastSocketFail());
+        packet->size = RtpaGetRecoveredPacket(&audioFecQueue, &packet->data[0], MAX_PACKET_SIZE);
+        if (packet->size == 0) {
             break;
         }
-        else if (packet->size == 0) {
-            // Receive timed out; try again
-            
-            if (!receivedDataFromPeer) {
-                waitingForAudioMs += UDP_RECV_POLL_TIMEOUT_MS;
-            }
 
-            // If we hit this path, there are no queued audio packets on the host PC,
-            // so we don't need to drop anything.
-            packetsToDrop = 0;
-            continue;
+        if (!queueAudioPacket(&packet, receiveTimeMs)) {
+            if (packet != NULL) {
+                freeAudioPacket(packet);
+            }
+            return 0;
         }
+    }
 
-        if (packet->size < sizeof(RTP_PACKET)) {
-            // Runt packet
-            continue;
-        }
+    if (packet != NULL) {
+        freeAudioPacket(packet);
+    }
 
-        rtp = (PRTP_PACKET)&packet->data[0];
-        if (rtp->packetType != 97) {
-            // Not audio
-            continue;
-        }
+    return 1;
+}
 
-        if (!receivedDataFromPeer) {
-            receivedDataFromPeer = 1;
-            Limelog("Received first audio packet after %d ms\n", waitingForAudioMs);
-        }
+// Reads a single datagram from the RTP socket and passes it through the
+// reorder queue. Returns the size of the datagram, 0 if no data was received,
+// or -1 if the receive loop must exit. The clock is read for the first
+// datagram of each wakeup and the time is stored in batchReceiveTimeUs, which
+// the caller sets to 0 before the wakeup's first read.
+static int receiveAudioPacket(int useSelect, uint64_t* batchReceiveTimeUs) {
+    PRTP_PACKET rtp;
+    uint64_t receiveTimeUs;
+    int size;
 
-        // GFE accumulates audio samples before we are ready to receive them,
-        // so we will drop the first 100 packets to avoid accumulating latency
-        // by sending audio frames to the player faster than they can be played.
-        if (packetsToDrop > 0) {
-            packetsToDrop--;
-            continue;
+    if (receivePacket == NULL) {
+        receivePacket = allocateAudioPacket();
+        if (receivePacket == NULL) {
+            char discardBuffer[MAX_PACKET_SIZE];
+
+            // Every packet is queued, so the decoder has fallen far behind.
+            // Keep draining the socket, but drop what we receive.
+            size = recvUdpSocket(rtpSocket, discardBuffer, sizeof(discardBuffer), useSelect);
+            if (size < 0) {
+                Limelog("Audio Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
+                ListenerCallbacks.connectionTerminated(LastSocketFail());
+                return -1;
+            }
+            return size;
         }
+    }
 
-        // Convert fields to host byte-order
-        rtp->sequenceNumber = htons(rtp->sequenceNumber);
-        rtp->timestamp = htonl(rtp->timestamp);
-        rtp->ssrc = htonl(rtp->ssrc);
-
-        queueStatus = RtpqAddPacket(&rtpReorderQueue, (PRTP_PACKET)packet, &packet->q.rentry);
-        if (RTPQ_HANDLE_NOW(queueStatus)) {
-            if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                if (!queuePacketToLbq(&packet)) {
-                    // An exit signal was received
-                    break;
-                }
-            }
-            else {
-                decodeInputData(packet);
+    size = receivePacket->size = recvUdpSocket(rtpSocket, &receivePacket->data[0], MAX_PACKET_SIZE, useSelect);
+    if (size < 0) {
+        Limelog("Audio Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
+        ListenerCallbacks.connectionTerminated(LastSocketFail());
+        return -1;
+    }
+    else if (size == 0) {
+        return 0;
+    }
+
+    if (*batchReceiveTimeUs == 0) {
+        *batchReceiveTimeUs = PltGetMicroseconds();
+    }
+    receiveTimeUs = *batchReceiveTimeUs;
+
+    if (size < sizeof(RTP_PACKET)) {
+        // Runt packet
+        return size;
+    }
+
+    rtp = (PRTP_PACKET)&receivePacket->data[0];
+    if (rtp->packetType == RTPA_FEC_PAYLOAD_TYPE) {
+        // Parity for the audio packets. Ignore it while we're still dropping
+        // the audio that accumulated on the host before we were ready.
+        if (packetsToDrop == 0) {
+            rtp->sequenceNumber = htons(rtp->sequenceNumber);
+            rtp->timestamp = htonl(rtp->timestamp);
+            rtp->ssrc = htonl(rtp->ssrc);
+
+            RtpaAddFecPacket(&audioFecQueue, rtp, size);
+            if (!queueRecoveredAudioPackets(receiveTimeUs / 1000)) {
+                return -1;
             }
         }
-        else {
-            if (RTPQ_PACKET_CONSUMED(queueStatus)) {
-                // The queue consumed our packet, so we must allocate a new one
-                packet = NULL;
-            }
+        return size;
+    }
+    else if (rtp->packetType != 97) {
+        // Not audio
+        return size;
+    }
 
-            if (RTPQ_PACKET_READY(queueStatus)) {
-                // If packets are ready, pull them and send them to the decoder
-                while ((packet = (PQUEUED_AUDIO_PACKET)RtpqGetQueuedPacket(&rtpReorderQueue)) != NULL) {
-                    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                        if (!queuePacketToLbq(&packet)) {
-                            // An exit signal was received
-                            break;
-                        }
-                    }
-                    else {
-                        decodeInputData(packet);
-                        free(packet);
-                    }
-                }
-                
-                // Break on exit
-                if (packet != NULL) {
-                    break;
-                }
-            }
+    if (!receivedDataFromPeer) {
+        receivedDataFromPeer = 1;
+        Limelog("Received first audio packet after %d ms\n", waitingForAudioMs);
+    }
+
+    // GFE accumulates audio samples before we are ready to receive them,
+    // so we will drop the first 100 packets to avoid accumulating latency
+    // by sending audio frames to the player faster than they can be played.
+    if (packetsToDrop > 0) {
+        packetsToDrop--;
+        return size;
+    }
+
+    // Convert fields to host byte-order
+    rtp->sequenceNumber = htons(rtp->sequenceNumber);
+    rtp->timestamp = htonl(rtp->timestamp);
+    rtp->ssrc = htonl(rtp->ssrc);
+
+    RtpdAddPacket(&clockDrift, rtp, receiveTimeUs);
+
+    // Remember this packet for FEC recovery. This may also complete recovery
+    // of earlier packets in its block if the parity arrived first.
+    RtpaAddDataPacket(&audioFecQueue, rtp, size);
+    if (!queueRecoveredAudioPackets(receiveTimeUs / 1000)) {
+        return -1;
+    }
+
+    if (!queueAudioPacket(&receivePacket, receiveTimeUs / 1000)) {
+        return -1;
+    }
+
+    return size;
+}
+
+// Called after UDP_RECV_POLL_TIMEOUT_MS without audio data
+static int handleAudioReceiveTimeout(void) {
+    if (!receivedDataFromPeer) {
+        waitingForAudioMs += UDP_RECV_POLL_TIMEOUT_MS;
+    }
+
+    // If we hit this path, there are no queued audio packets on the host PC,
+    // so we don't need to drop anything.
+    packetsToDrop = 0;
+    return 0;
+}
+
+static void ReceiveThreadProc(void* context) {
+    int err;
+    int useSelect;
+    uint64_t receiveTimeUs;
+
+    if (setNonFatalRecvTimeoutMs(rtpSocket, UDP_RECV_POLL_TIMEOUT_MS) < 0) {
+        // SO_RCVTIMEO failed, so use select() to wait
+        useSelect = 1;
+    }
+    else {
+        // SO_RCVTIMEO timeout set for recv()
+        useSelect = 0;
+    }
+
+    while (!PltIsThreadInterrupted(&receiveThread)) {
+        // This thread wakes up for each datagram
+        receiveTimeUs = 0;
+        err = receiveAudioPacket(useSelect, &receiveTimeUs);
+        if (err < 0) {
+            break;
+        }
+        else if (err == 0) {
+            // Receive timed out; try again
+            handleAudioReceiveTimeout();
         }
     }
-    
-    if (packet != NULL) {
-        free(packet);
+}
+
+// Shared receive thread handler for the RTP socket
+static int receiveAudioPackets(int maxPackets) {
+    uint64_t receiveTimeUs;
+    int err;
+
+    // The datagrams drained in one wakeup share a receive time
+    receiveTimeUs = 0;
+    while (maxPackets-- > 0) {
+        err = receiveAudioPacket(0, &receiveTimeUs);
+        if (err <= 0) {
+            return err;
+        }
     }
+
+    return 0;
 }
 
 static void DecoderThreadProc(void* context) {
@@ -255,9 +526,15 @@ static void DecoderThreadProc(void* context) {
             return;
         }
 
-        decodeInputData(packet);
+        if (shouldTrimAudioPacket()) {
+            // Skip this packet without triggering concealment for the gap
+            lastSeq = ((PRTP_PACKET)&packet->data[0])->sequenceNumber;
+        }
+        else {
+            decodeInputData(packet);
+        }
 
-        free(packet);
+        freeAudioPacket(packet);
     }
 }
 
@@ -268,22 +545,31 @@ void stopAudioStream(void) {
 
     AudioCallbacks.stop();
 
-    PltInterruptThread(&udpPingThread);
-    PltInterruptThread(&receiveThread);
+    if (StreamConfig.useSharedReceiveThread) {
+        removeRtpReactorHandler(&reactorHandler);
+    }
+    else {
+        PltInterruptThread(&udpPingThread);
+        PltInterruptThread(&receiveThread);
+    }
     if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {        
         // Signal threads waiting on the LBQ
         LbqSignalQueueShutdown(&packetQueue);
         PltInterruptThread(&decoderThread);
     }
     
-    PltJoinThread(&udpPingThread);
-    PltJoinThread(&receiveThread);
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltJoinThread(&udpPingThread);
+        PltJoinThread(&receiveThread);
+    }
     if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         PltJoinThread(&decoderThread);
     }
 
-    PltCloseThread(&udpPingThread);
-    PltCloseThread(&receiveThread);
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltCloseThread(&udpPingThread);
+        PltCloseThread(&receiveThread);
+    }
     if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         PltCloseThread(&decoderThread);
     }
@@ -292,6 +578,10 @@ void stopAudioStream(void) {
         closeSocket(rtpSocket);
         rtpSocket = INVALID_SOCKET;
     }
+    if (receivePacket != NULL) {
+        freeAudioPacket(receivePacket);
+        receivePacket = NULL;
+    }
 
     AudioCallbacks.cleanup();
 }
@@ -328,22 +618,34 @@ int startAudioStream(void* audioContext, int arFlags) {
 
     AudioCallbacks.start();
 
-    err = PltCreateThread("AudioRecv", ReceiveThreadProc, NULL, &receiveThread);
-    if (err != 0) {
-        AudioCallbacks.stop();
-        closeSocket(rtpSocket);
-        AudioCallbacks.cleanup();
-        return err;
+    packetsToDrop = 500 / AudioPacketDuration;
+
+    // The shared receive thread begins receiving once the ping handler
+    // is registered below
+    if (!StreamConfig.useSharedReceiveThread) {
+        err = PltCreateThread("AudioRecv", ReceiveThreadProc, NULL, &receiveThread);
+        if (err != 0) {
+            AudioCallbacks.stop();
+            closeSocket(rtpSocket);
+            AudioCallbacks.cleanup();
+            return err;
+        }
     }
 
     if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         err = PltCreateThread("AudioDec", DecoderThreadProc, NULL, &decoderThread);
         if (err != 0) {
             AudioCallbacks.stop();
-            PltInterruptThread(&receiveThread);
-            PltJoinThread(&receiveThread);
-            PltCloseThread(&receiveThread);
+            if (!StreamConfig.useSharedReceiveThread) {
+                PltInterruptThread(&receiveThread);
+                PltJoinThread(&receiveThread);
+                PltCloseThread(&receiveThread);
+            }
             closeSocket(rtpSocket);
+            if (receivePacket != NULL) {
+                freeAudioPacket(receivePacket);
+                receivePacket = NULL;
+            }
             AudioCallbacks.cleanup();
             return err;
         }
@@ -353,24 +655,43 @@ int startAudioStream(void* audioContext, int arFlags) {
     // until everything else is started. Otherwise we could accumulate a
     // bunch of audio packets in the socket receive buffer while our audio
     // backend is starting up and create audio latency.
-    err = PltCreateThread("AudioPing", UdpPingThreadProc, NULL, &udpPingThread);
+    if (StreamConfig.useSharedReceiveThread) {
+        reactorHandler.socket = rtpSocket;
+        reactorHandler.receive = receiveAudioPackets;
+        reactorHandler.timeout = handleAudioReceiveTimeout;
+        reactorHandler.ping = sendAudioPing;
+        err = addRtpReactorHandler(&reactorHandler);
+    }
+    else {
+        err = PltCreateThread("AudioPing", UdpPingThreadProc, NULL, &udpPingThread);
+    }
     if (err != 0) {
         AudioCallbacks.stop();
-        PltInterruptThread(&receiveThread);
+        if (!StreamConfig.useSharedReceiveThread) {
+            PltInterruptThread(&receiveThread);
+        }
         if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
             // Signal threads waiting on the LBQ
             LbqSignalQueueShutdown(&packetQueue);
             PltInterruptThread(&decoderThread);
         }
-        PltJoinThread(&receiveThread);
+        if (!StreamConfig.useSharedReceiveThread) {
+            PltJoinThread(&receiveThread);
+        }
         if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
             PltJoinThread(&decoderThread);
         }
-        PltCloseThread(&receiveThread);
+        if (!StreamConfig.useSharedReceiveThread) {
+            PltCloseThread(&receiveThread);
+        }
         if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
             PltCloseThread(&decoderThread);
         }
         closeSocket(rtpSocket);
+        if (receivePacket != NULL) {
+            freeAudioPacket(receivePacket);
+            receivePacket = NULL;
+        }
         AudioCallbacks.cleanup();
         return err;
     }
@@ -385,3 +706,7 @@ int LiGetPendingAudioFrames(void) {
 int LiGetPendingAudioDuration(void) {
     return LiGetPendingAudioFrames() * AudioPacketDuration;
 }
+
+int LiGetEstimatedAudioClockDrift(int* driftPpm) {
+    return RtpdGetDriftPpm(&clockDrift, driftPpm);
+}
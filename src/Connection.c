@@ -6,6 +6,13 @@ static ConnListenerConnectionTerminated originalTerminationCallback;
 static int alreadyTerminated;
 static PLT_THREAD terminationCallbackThread;
 static int terminationCallbackErrorCode;
+static ConnListenerStageStarting originalStageStartingCallback;
+static ConnListenerStageComplete originalStageCompleteCallback;
+
+// Startup timings are measured from the start of LiStartConnection()
+static STARTUP_REPORT startupReport;
+static uint64_t connectionStartTimeMs;
+static uint64_t stageStartTimeMs;
 
 // Common globals
 char* RemoteAddrString;
@@ -167,6 +174,58 @@ static void ClInternalConnectionTerminated(int errorCode)
     PltCloseThread(&terminationCallbackThread);
 }
 
+// These shim callbacks time each stage of LiStartConnection(), not counting
+// the time spent in the client's callbacks.
+static void ClInternalStageStarting(int stage)
+{
+    originalStageStartingCallback(stage);
+    stageStartTimeMs = PltGetMillis();
+}
+
+static void ClInternalStageComplete(int stage)
+{
+    startupReport.stageDurationMs[stage] = (unsigned int)(PltGetMillis() - stageStartTimeMs);
+    originalStageCompleteCallback(stage);
+}
+
+static unsigned int getTimeSinceConnectionStartMs(void) {
+    return (unsigned int)(PltGetMillis() - connectionStartTimeMs);
+}
+
+// Called by the RTSP handshake after each request completes
+void connectionRecordRtspRequestTime(const char* command, unsigned int durationMs) {
+    if (strcmp(command, "OPTIONS") == 0) {
+        startupReport.rtspOptionsMs += durationMs;
+    }
+    else if (strcmp(command, "DESCRIBE") == 0) {
+        startupReport.rtspDescribeMs += durationMs;
+    }
+    else if (strcmp(command, "SETUP") == 0) {
+        startupReport.rtspSetupMs += durationMs;
+    }
+    else if (strcmp(command, "ANNOUNCE") == 0) {
+        startupReport.rtspAnnounceMs += durationMs;
+    }
+    else if (strcmp(command, "PLAY") == 0) {
+        startupReport.rtspPlayMs += durationMs;
+    }
+}
+
+// Called by the video stream when the first packet arrives
+void connectionReceivedFirstVideoPacket(void) {
+    startupReport.firstVideoPacketMs = getTimeSinceConnectionStartMs();
+}
+
+// Called by the video stream when the first complete frame is submitted
+void connectionReceivedFirstFrame(void) {
+    startupReport.firstFrameMs = getTimeSinceConnectionStartMs();
+    Limelog("First video frame submitted %u ms after connection start\n", startupReport.firstFrameMs);
+}
+
+void LiGetStartupReport(PSTARTUP_REPORT report) {
+    memcpy(report, &startupReport, sizeof(*report));
+}
+
 // Starts the connection to the streaming machine
 int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION streamConfig, PCONNECTION_LISTENER_CALLBACKS clCallbacks,
     PDECODER_RENDERER_CALLBACKS drCallbacks, PAUDIO_RENDERER_CALLBACKS arCallbacks, void* renderContext, int drFlags,
@@ -186,6 +245,14 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
     memcpy(&ListenerCallbacks, clCallbacks, sizeof(ListenerCallbacks));
     ListenerCallbacks.connectionTerminated = ClInternalConnectionTerminated;
 
+    // Hook the stage callbacks to time each stage
+    memset(&startupReport, 0, sizeof(startupReport));
+    connectionStartTimeMs = PltGetMillis();
+    originalStageStartingCallback = clCallbacks->stageStarting;
+    originalStageCompleteCallback = clCallbacks->stageComplete;
+    ListenerCallbacks.stageStarting = ClInternalStageStarting;
+    ListenerCallbacks.stageComplete = ClInternalStageComplete;
+
     NegotiatedVideoFormat = 0;
     memcpy(&StreamConfig, streamConfig, sizeof(StreamConfig));
     OriginalVideoBitrate = streamConfig->bitrate;
@@ -289,6 +356,33 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
         }
     }
 
+    if (StreamConfig.probeServer != NULL) {
+        PROBE_RESULT probeResult;
+        uint64_t probeStartTimeMs = PltGetMillis();
+
+        Limelog("Probing connection...");
+        err = LiProbeConnection(StreamConfig.probeServer, StreamConfig.probePort,
+                                StreamConfig.bitrate, StreamConfig.packetSize, &probeResult);
+        startupReport.probeMs = (unsigned int)(PltGetMillis() - probeStartTimeMs);
+        if (err == 0) {
+            Limelog("done\n");
+
+            if (probeResult.recommendedBitrate < StreamConfig.bitrate) {
+                Limelog("Bitrate lowered to %d Kbps after probe\n", probeResult.recommendedBitrate);
+                StreamConfig.bitrate = probeResult.recommendedBitrate;
+            }
+            if (probeResult.recommendedPacketSize < StreamConfig.packetSize) {
+                Limelog("Packet size lowered to %d after probe\n", probeResult.recommendedPacketSize);
+                StreamConfig.packetSize = probeResult.recommendedPacketSize;
+            }
+        }
+        else {
+            // The stream can still work with the requested settings
+            Limelog("failed: %d\n", err);
+            err = 0;
+        }
+    }
+
     Limelog("Starting RTSP handshake...");
     ListenerCallbacks.stageStarting(STAGE_RTSP_HANDSHAKE);
     err = performRtspHandshake();
@@ -325,7 +419,12 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
 
     Limelog("Initializing audio stream...");
     ListenerCallbacks.stageStarting(STAGE_AUDIO_STREAM_INIT);
-    initializeAudioStream();
+    err = initializeAudioStream();
+    if (err != 0) {
+        Limelog("failed: %d\n", err);
+        ListenerCallbacks.stageFailed(STAGE_AUDIO_STREAM_INIT, err);
+        goto Cleanup;
+    }
     stage++;
     LC_ASSERT(stage == STAGE_AUDIO_STREAM_INIT);
     ListenerCallbacks.stageComplete(STAGE_AUDIO_STREAM_INIT);
@@ -333,7 +432,12 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
 
     Limelog("Initializing input stream...");
     ListenerCallbacks.stageStarting(STAGE_INPUT_STREAM_INIT);
-    initializeInputStream();
+    err = initializeInputStream();
+    if (err != 0) {
+        Limelog("failed: %d\n", err);
+        ListenerCallbacks.stageFailed(STAGE_INPUT_STREAM_INIT, err);
+        goto Cleanup;
+    }
     stage++;
     LC_ASSERT(stage == STAGE_INPUT_STREAM_INIT);
     ListenerCallbacks.stageComplete(STAGE_INPUT_STREAM_INIT);
@@ -397,6 +501,7 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
     LiSendMouseMoveEvent(-1, -1);
     PltSleepMs(10);
 
+    startupReport.connectionStartedMs = getTimeSinceConnectionStartMs();
     ListenerCallbacks.connectionStarted();
 
 Cleanup:
@@ -0,0 +1,181 @@
+#include "Limelight-internal.h"
+
+// Estimates the quality of the video path from each finished FEC block
+// (one per frame). Every metric is an exponentially weighted moving average
+// updated once per frame with a gain of 1/16, so it follows changes within
+// a few hundred milliseconds at typical frame rates.
+
+#define QUALITY_SCALE 16
+
+// The lowest one-way delay rises towards the current delay with this gain,
+// which lets the baseline follow clock drift and route changes over
+// tens of seconds while queuing delay still shows up above it.
+#define DELAY_BASELINE_SCALE 1024
+
+// Limits the effect of a single stall on the delay metrics
+#define MAX_DELAY_SAMPLE_US 1000000
+
+// Caps how many skipped frames are counted at once after a long gap
+#define MAX_SKIPPED_FRAMES 64
+
+static PLT_MUTEX qualityMutex;
+
+static int haveFrame;
+static int lastFrameIndex;
+static unsigned int lastRtpTimestamp;
+static int64_t extendedTimestampUs;
+static uint64_t lastReceiveTimeUs;
+static int64_t lastRelativeDelayUs;
+static int64_t baselineDelayUs;
+
+// Scaled by QUALITY_SCALE
+static int scaledPacketLoss;
+static int scaledFrameLoss;
+static int scaledJitterUs;
+static int scaledFecUsage;
+static int scaledDelayChangeUs;
+static int scaledFrameIntervalUs;
+
+static void updateAverage(int* scaledAverage, int sample) {
+    *scaledAverage += sample - (*scaledAverage + QUALITY_SCALE / 2) / QUALITY_SCALE;
+}
+
+static unsigned int getAverage(int scaledAverage) {
+    return scaledAverage > 0 ? (unsigned int)((scaledAverage + QUALITY_SCALE / 2) / QUALITY_SCALE) : 0;
+}
+
+void initializeConnectionQuality(void) {
+    PltCreateMutex(&qualityMutex);
+
+    haveFrame = 0;
+    scaledPacketLoss = 0;
+    scaledFrameLoss = 0;
+    scaledJitterUs = 0;
+    scaledFecUsage = 0;
+    scaledDelayChangeUs = 0;
+    scaledFrameIntervalUs = 0;
+}
+
+void destroyConnectionQuality(void) {
+    PltDeleteMutex(&qualityMutex);
+}
+
+// Called by the FEC queue when it's done with a frame, either because it was
+// completed (possibly with FEC recovery) or because it was abandoned.
+// skippedPackets are packets between the previous FEC block and this one.
+void connectionQualityAddFrame(int frameIndex, unsigned int rtpTimestamp, uint64_t receiveTimeUs,
+                               int dataPackets, int parityPackets, int missingDataPackets,
+                               int skippedPackets, int completed) {
+    int lostPackets;
+    int totalPackets;
+    int fecUsage;
+    int64_t relativeDelayUs;
+
+    PltLockMutex(&qualityMutex);
+
+    // Frames that never reached the FEC queue were lost
+    if (haveFrame && isBefore16(lastFrameIndex, frameIndex)) {
+        int skippedFrames = U16(frameIndex - lastFrameIndex) - 1;
+
+        if (skippedFrames > MAX_SKIPPED_FRAMES) {
+            skippedFrames = MAX_SKIPPED_FRAMES;
+        }
+        while (skippedFrames-- > 0) {
+            updateAverage(&scaledFrameLoss, 1000);
+        }
+    }
+    updateAverage(&scaledFrameLoss, completed ? 0 : 1000);
+
+    // Packet loss after FEC recovery
+    lostPackets = skippedPackets + (completed ? 0 : missingDataPackets);
+    totalPackets = skippedPackets + dataPackets + parityPackets;
+    updateAverage(&scaledPacketLoss, totalPackets > 0 ? lostPackets * 1000 / totalPackets : 0);
+
+    // Share of the parity packets that were needed to recover the frame
+    if (!completed) {
+        fecUsage = missingDataPackets > 0 ? 1000 : 0;
+    }
+    else if (parityPackets > 0) {
+        fecUsage = missingDataPackets * 1000 / parityPackets;
+    }
+    else {
+        fecUsage = 0;
+    }
+    updateAverage(&scaledFecUsage, fecUsage);
+
+    if (!haveFrame) {
+        extendedTimestampUs = 0;
+        relativeDelayUs = (int64_t)receiveTimeUs;
+        baselineDelayUs = relativeDelayUs;
+    }
+    else {
+        int64_t transitDeltaUs;
+        int64_t receiveDeltaUs;
+
+        // 90 KHz video clock. Reordered frames move the timestamp backwards.
+        extendedTimestampUs += (int64_t)(int)(rtpTimestamp - lastRtpTimestamp) * 100 / 9;
+        relativeDelayUs = (int64_t)receiveTimeUs - extendedTimestampUs;
+
+        // Interarrival jitter as in RFC 3550
+        transitDeltaUs = relativeDelayUs - lastRelativeDelayUs;
+        if (transitDeltaUs > MAX_DELAY_SAMPLE_US) {
+            transitDeltaUs = MAX_DELAY_SAMPLE_US;
+        }
+        else if (transitDeltaUs < -MAX_DELAY_SAMPLE_US) {
+            transitDeltaUs = -MAX_DELAY_SAMPLE_US;
+        }
+        updateAverage(&scaledJitterUs, (int)(transitDeltaUs < 0 ? -transitDeltaUs : transitDeltaUs));
+
+        // The delay trend is the average change in one-way delay over the
+        // average time between frames. Averaging them separately keeps
+        // irregular frame spacing from biasing the trend.
+        receiveDeltaUs = (int64_t)(receiveTimeUs - lastReceiveTimeUs);
+        if (receiveDeltaUs > MAX_DELAY_SAMPLE_US) {
+            receiveDeltaUs = MAX_DELAY_SAMPLE_US;
+        }
+        updateAverage(&scaledDelayChangeUs, (int)transitDeltaUs);
+        updateAverage(&scaledFrameIntervalUs, (int)receiveDeltaUs);
+
+        if (relativeDelayUs < baselineDelayUs) {
+            baselineDelayUs = relativeDelayUs;
+        }
+        else {
+            baselineDelayUs += (relativeDelayUs - baselineDelayUs) / DELAY_BASELINE_SCALE;
+        }
+    }
+
+    lastFrameIndex = frameIndex;
+    lastRtpTimestamp = rtpTimestamp;
+    lastReceiveTimeUs = receiveTimeUs;
+    lastRelativeDelayUs = relativeDelayUs;
+    haveFrame = 1;
+
+    PltUnlockMutex(&qualityMutex);
+}
+
+int LiGetConnectionQuality(PCONNECTION_QUALITY quality) {
+    int ret;
+
+    memset(quality, 0, sizeof(*quality));
+
+    PltLockMutex(&qualityMutex);
+
+    if (haveFrame) {
+        quality->packetLossPerMille = getAverage(scaledPacketLoss);
+        quality->frameLossPerMille = getAverage(scaledFrameLoss);
+        quality->fecUsagePerMille = getAverage(scaledFecUsage);
+        quality->jitterUs = getAverage(scaledJitterUs);
+        quality->queuingDelayUs = (unsigned int)(lastRelativeDelayUs - baselineDelayUs);
+        if (scaledFrameIntervalUs > 0) {
+            quality->delayTrendUsPerSec = (int)((int64_t)scaledDelayChangeUs * 1000000 / scaledFrameIntervalUs);
+        }
+        ret = 0;
+    }
+    else {
+        ret = -1;
+    }
+
+    PltUnlockMutex(&qualityMutex);
+
+    return ret;
+}
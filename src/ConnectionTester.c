@@ -278,3 +278,351 @@ Exit:
     cleanupPlatformSockets();
     return failingPortFlags;
 }
+
+#define PROBE_RECV_BUFFER (1024 * 1024)
+#define PROBE_MIN_PACKET_SIZE 1024
+#define PROBE_SIZE_TEST_PACKETS 10
+#define PROBE_SIZE_TEST_MIN_REPLIES 8
+#define PROBE_BURST_DURATION_MS 100
+#define PROBE_REPLY_TIMEOUT_MS 500
+#define PROBE_START_BITRATE 2000
+#define PROBE_MAX_LOSS_PER_MILLE 20
+#define PROBE_MIN_THROUGHPUT_PERCENT 80
+#define PROBE_BITRATE_HEADROOM_PERCENT 80
+
+// Probe packets are padded to the size of a video packet. The echo server
+// sends them back unmodified.
+#define PROBE_DATAGRAM_SIZE(packetSize) ((packetSize) + MAX_RTP_HEADER_SIZE + (int)sizeof(NV_VIDEO_PACKET))
+
+typedef struct _PROBE_PACKET_HEADER {
+    char magic[8];
+    unsigned int burst;
+    unsigned int sequence;
+    uint64_t sendTimeUs;
+} PROBE_PACKET_HEADER, *PPROBE_PACKET_HEADER;
+
+static const char probeMagic[8] = "mlprobe";
+
+typedef struct _PROBE_BURST_STATS {
+    unsigned int burst;
+    int sentPackets;
+    int receivedPackets;
+    uint64_t receivedBytes;
+    uint64_t firstReceiveTimeUs;
+    uint64_t lastReceiveTimeUs;
+    uint64_t totalRttUs;
+    int64_t lastRttUs;
+    int scaledJitterUs;
+} PROBE_BURST_STATS, *PPROBE_BURST_STATS;
+
+static int sendProbePacket(SOCKET s, char* buffer, int datagramSize, PPROBE_BURST_STATS stats) {
+    PPROBE_PACKET_HEADER header = (PPROBE_PACKET_HEADER)buffer;
+    int err;
+
+    memcpy(header->magic, probeMagic, sizeof(header->magic));
+    header->burst = stats->burst;
+    header->sequence = stats->sentPackets;
+    header->sendTimeUs = PltGetMicroseconds();
+
+    err = (int)send(s, buffer, datagramSize, 0);
+    if (err < 0) {
+        err = LastSocketError();
+        if (err == EWOULDBLOCK || err == EAGAIN) {
+            // The send buffer is full, so count it as lost
+            stats->sentPackets++;
+            return 0;
+        }
+
+        Limelog("Failed to send probe packet: %d\n", err);
+        return err;
+    }
+
+    stats->sentPackets++;
+    return 0;
+}
+
+// Reads echoed packets of the current burst. If timeoutMs is non-zero, this
+// waits until all packets have come back or nothing arrives for timeoutMs.
+static int receiveProbeReplies(SOCKET s, char* buffer, int bufferSize, PPROBE_BURST_STATS stats, int timeoutMs) {
+    for (;;) {
+        int err;
+
+        if (timeoutMs != 0) {
+            struct pollfd pfd;
+
+            pfd.fd = s;
+            pfd.events = POLLIN;
+            err = pollSockets(&pfd, 1, timeoutMs);
+            if (err < 0) {
+                err = LastSocketFail();
+                Limelog("pollSockets() failed: %d\n", err);
+                return err;
+            }
+            else if (err == 0) {
+                return 0;
+            }
+        }
+
+        while ((err = (int)recv(s, buffer, bufferSize, 0)) > 0) {
+            PPROBE_PACKET_HEADER header = (PPROBE_PACKET_HEADER)buffer;
+            uint64_t now = PltGetMicroseconds();
+            int64_t rttUs;
+
+            // Ignore anything that isn't ours and late replies from earlier bursts
+            if (err < (int)sizeof(*header) ||
+                    memcmp(header->magic, probeMagic, sizeof(header->magic)) != 0 ||
+                    header->burst != stats->burst) {
+                continue;
+            }
+
+            rttUs = (int64_t)(now - header->sendTimeUs);
+            if (stats->receivedPackets == 0) {
+                stats->firstReceiveTimeUs = now;
+            }
+            else {
+                // Interarrival jitter as in RFC 3550
+                int64_t deltaUs = rttUs - stats->lastRttUs;
+                stats->scaledJitterUs += (int)(deltaUs < 0 ? -deltaUs : deltaUs) - (stats->scaledJitterUs + 8) / 16;
+            }
+
+            stats->receivedPackets++;
+            stats->receivedBytes += err;
+            stats->lastReceiveTimeUs = now;
+            stats->totalRttUs += rttUs;
+            stats->lastRttUs = rttUs;
+        }
+
+        if (err < 0) {
+            err = LastSocketError();
+#if defined(LC_WINDOWS)
+            if (err != EWOULDBLOCK && err != EAGAIN && err != WSAECONNRESET) {
+#else
+            if (err != EWOULDBLOCK && err != EAGAIN && err != ECONNREFUSED) {
+#endif
+                Limelog("Failed to receive probe reply: %d\n", err);
+                return err;
+            }
+        }
+
+        if (timeoutMs == 0 || stats->receivedPackets >= stats->sentPackets) {
+            return 0;
+        }
+    }
+}
+
+// Sends packets evenly over the burst duration at the given rate
+static int sendProbeBurst(SOCKET s, char* buffer, int datagramSize, int bitrateKbps, PPROBE_BURST_STATS stats) {
+    int packetCount;
+    uint64_t startTimeUs;
+    int err;
+
+    packetCount = (int)((int64_t)bitrateKbps * PROBE_BURST_DURATION_MS / 8 / datagramSize);
+    if (packetCount == 0) {
+        packetCount = 1;
+    }
+
+    startTimeUs = PltGetMicroseconds();
+    while (stats->sentPackets < packetCount) {
+        uint64_t elapsedUs = PltGetMicroseconds() - startTimeUs;
+        int duePackets = (int)((int64_t)packetCount * elapsedUs / (PROBE_BURST_DURATION_MS * 1000)) + 1;
+
+        if (duePackets > packetCount) {
+            duePackets = packetCount;
+        }
+
+        while (stats->sentPackets < duePackets) {
+            err = sendProbePacket(s, buffer, datagramSize, stats);
+            if (err != 0) {
+                return err;
+            }
+        }
+
+        // Keep the receive buffer drained while we send
+        err = receiveProbeReplies(s, buffer, datagramSize, stats, 0);
+        if (err != 0) {
+            return err;
+        }
+
+        if (stats->sentPackets < packetCount) {
+            PltSleepMs(1);
+        }
+    }
+
+    return 0;
+}
+
+int LiProbeConnection(const char* probeServer, unsigned short probePort, int maxBitrate, int maxPacketSize, PPROBE_RESULT result)
+{
+    struct sockaddr_storage address;
+    SOCKADDR_LEN addressLength;
+    PROBE_BURST_STATS stats;
+    SOCKET s;
+    char* buffer;
+    int packetSize;
+    int datagramSize;
+    int bitrate;
+    int measuredBitrate;
+    int i;
+    int err;
+
+    memset(result, 0, sizeof(*result));
+    s = INVALID_SOCKET;
+    buffer = NULL;
+
+    // FEC only works in 16 byte chunks
+    maxPacketSize -= maxPacketSize % 16;
+    if (maxPacketSize < PROBE_MIN_PACKET_SIZE || maxBitrate <= 0) {
+        return -1;
+    }
+
+    err = initializePlatformSockets();
+    if (err != 0) {
+        Limelog("Failed to initialize sockets: %d\n", err);
+        return err;
+    }
+
+    err = resolveHostName(probeServer, AF_UNSPEC, 0, &address, &addressLength);
+    if (err != 0) {
+        goto Exit;
+    }
+    ((struct sockaddr_in6*)&address)->sin6_port = htons(probePort);
+
+    s = bindUdpSocket(address.ss_family, PROBE_RECV_BUFFER);
+    if (s == INVALID_SOCKET) {
+        err = LastSocketFail();
+        goto Exit;
+    }
+
+    if (connect(s, (struct sockaddr*)&address, addressLength) < 0) {
+        err = LastSocketFail();
+        Limelog("Failed to connect probe socket: %d\n", err);
+        goto Exit;
+    }
+
+    setSocketNonBlocking(s, 1);
+
+    buffer = malloc(PROBE_DATAGRAM_SIZE(maxPacketSize));
+    if (buffer == NULL) {
+        err = -1;
+        goto Exit;
+    }
+    memset(buffer, 0, PROBE_DATAGRAM_SIZE(maxPacketSize));
+
+    // Find out if full size packets get through. If not, fall back to
+    // the packet size used for remote streaming.
+    packetSize = maxPacketSize;
+    for (;;) {
+        datagramSize = PROBE_DATAGRAM_SIZE(packetSize);
+
+        memset(&stats, 0, sizeof(stats));
+        stats.burst = 1;
+        for (i = 0; i < PROBE_SIZE_TEST_PACKETS; i++) {
+            err = sendProbePacket(s, buffer, datagramSize, &stats);
+            if (err != 0) {
+                goto Exit;
+            }
+        }
+
+        err = receiveProbeReplies(s, buffer, datagramSize, &stats, PROBE_REPLY_TIMEOUT_MS);
+        if (err != 0) {
+            goto Exit;
+        }
+
+        if (stats.receivedPackets >= PROBE_SIZE_TEST_MIN_REPLIES) {
+            break;
+        }
+        else if (packetSize == PROBE_MIN_PACKET_SIZE) {
+            Limelog("Probe server returned %d of %d packets\n", stats.receivedPackets, stats.sentPackets);
+            err = -1;
+            goto Exit;
+        }
+
+        Limelog("Packet size %d failed probe (%d of %d returned)\n",
+                packetSize, stats.receivedPackets, stats.sentPackets);
+        packetSize = PROBE_MIN_PACKET_SIZE;
+    }
+
+    // The unloaded round trip time and jitter
+    result->recommendedPacketSize = packetSize;
+    result->rttMs = (unsigned int)(stats.totalRttUs / stats.receivedPackets / 1000);
+    result->jitterUs = (unsigned int)((stats.scaledJitterUs + 8) / 16);
+
+    // Double the rate of each burst until the path stops keeping up
+    bitrate = maxBitrate < PROBE_START_BITRATE ? maxBitrate : PROBE_START_BITRATE;
+    for (;;) {
+        int lossPerMille;
+
+        memset(&stats, 0, sizeof(stats));
+        stats.burst = 2 + bitrate;
+
+        err = sendProbeBurst(s, buffer, datagramSize, bitrate, &stats);
+        if (err != 0) {
+            goto Exit;
+        }
+
+        err = receiveProbeReplies(s, buffer, datagramSize, &stats, PROBE_REPLY_TIMEOUT_MS);
+        if (err != 0) {
+            goto Exit;
+        }
+
+        lossPerMille = (stats.sentPackets - stats.receivedPackets) * 1000 / stats.sentPackets;
+        if (stats.receivedPackets > 1 && stats.lastReceiveTimeUs > stats.firstReceiveTimeUs) {
+            // Bits per millisecond over the time the burst took to come back
+            measuredBitrate = (int)(stats.receivedBytes * 8 * 1000 / (stats.lastReceiveTimeUs - stats.firstReceiveTimeUs));
+        }
+        else {
+            measuredBitrate = 0;
+        }
+
+        Limelog("Probe at %d Kbps: received %d Kbps with %d.%d%% loss\n",
+                bitrate, measuredBitrate, lossPerMille / 10, lossPerMille % 10);
+
+        if (lossPerMille > PROBE_MAX_LOSS_PER_MILLE ||
+                measuredBitrate < bitrate * PROBE_MIN_THROUGHPUT_PERCENT / 100) {
+            if (result->throughputKbps == 0) {
+                // Even the first burst was too fast, so use what made it through
+                result->throughputKbps = measuredBitrate;
+                result->lossPerMille = lossPerMille;
+            }
+            break;
+        }
+
+        // The receive rate can exceed the send rate when packets bunch up,
+        // so the rate we sent at is what the path has shown it can sustain.
+        result->throughputKbps = bitrate;
+        result->lossPerMille = lossPerMille;
+
+        if (bitrate >= maxBitrate) {
+            break;
+        }
+
+        bitrate = bitrate < maxBitrate / 2 ? bitrate * 2 : maxBitrate;
+    }
+
+    if (result->throughputKbps == 0) {
+        Limelog("Probe server returned no packets at %d Kbps\n", bitrate);
+        err = -1;
+        goto Exit;
+    }
+
+    // Leave headroom for audio, FEC and variations in the available bandwidth
+    result->recommendedBitrate = result->throughputKbps * PROBE_BITRATE_HEADROOM_PERCENT / 100;
+    if (result->recommendedBitrate > maxBitrate) {
+        result->recommendedBitrate = maxBitrate;
+    }
+
+    Limelog("Probe result: %d Kbps sustained, RTT %u ms, recommended bitrate %d Kbps and packet size %d\n",
+            result->throughputKbps, result->rttMs, result->recommendedBitrate, result->recommendedPacketSize);
+
+Exit:
+    if (buffer != NULL) {
+        free(buffer);
+    }
+
+    if (s != INVALID_SOCKET) {
+        closeSocket(s);
+    }
+
+    cleanupPlatformSockets();
+    return err;
+}
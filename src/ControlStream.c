@@ -3,6 +3,8 @@
 #include "PlatformThreads.h"
 
 #include "ByteBuffer.h"
+#include "MpscQueue.h"
+#include "PlatformAtomics.h"
 
 #include <enet/enet.h>
 
@@ -16,23 +18,52 @@ typedef struct _NVCTL_ENET_PACKET_HEADER {
     unsigned short type;
 } NVCTL_ENET_PACKET_HEADER, *PNVCTL_ENET_PACKET_HEADER;
 
-typedef struct _QUEUED_FRAME_INVALIDATION_TUPLE {
-    int startFrame;
-    int endFrame;
-    LINKED_BLOCKING_QUEUE_ENTRY entry;
-} QUEUED_FRAME_INVALIDATION_TUPLE, *PQUEUED_FRAME_INVALIDATION_TUPLE;
+typedef struct _OUTSTANDING_REQUEST {
+    short type;
+    uint64_t sendTimeMs;
+} OUTSTANDING_REQUEST, *POUTSTANDING_REQUEST;
 
 static SOCKET ctlSock = INVALID_SOCKET;
 static ENetHost* client;
 static ENetPeer* peer;
-static PLT_MUTEX enetMutex;
 static int usePeriodicPing;
 
+#define MAX_OUTSTANDING_REQUESTS 32
+
+// The ENet host is owned by the control stream thread. Other threads queue
+// their messages here and wake it with a datagram on the wake socket.
+static MPSC_QUEUE enetMessageQueue;
+
+// A message waiting for the control stream thread to hand it to ENet
+typedef struct _QUEUED_ENET_MESSAGE {
+    ENetPacket* packet;
+
+    // When the input stream queued the event, or 0 for other messages
+    uint64_t inputEnqueueTimeUs;
+} QUEUED_ENET_MESSAGE, *PQUEUED_ENET_MESSAGE;
+static SOCKET wakeSock = INVALID_SOCKET;
+static volatile int wakePending;
+
+// Requests sent over TCP that are waiting for a reply. The host replies
+// in order, so the receive thread matches each reply to the oldest request.
+static PLT_MUTEX outstandingRequestMutex;
+static OUTSTANDING_REQUEST outstandingRequests[MAX_OUTSTANDING_REQUESTS];
+static int outstandingRequestHead;
+static int outstandingRequestCount;
+
+// A snapshot of the ENet peer's link statistics taken by the control
+// stream thread, since other threads can't safely read the peer
+static PLT_MUTEX linkStatsMutex;
+static CONTROL_LINK_STATS linkStats;
+static int haveLinkStats;
+static enet_uint32 lastPeerPacketsSent;
+static enet_uint32 lastPeerPacketsLost;
+
 static PLT_THREAD lossStatsThread;
 static PLT_THREAD invalidateRefFramesThread;
 static PLT_THREAD controlReceiveThread;
 static PLT_EVENT invalidateRefFramesEvent;
-static int lossCountSinceLastReport;
+static volatile int lossCountSinceLastReport;
 static long lastGoodFrame;
 static long lastSeenFrame;
 static int stopping;
@@ -44,8 +75,24 @@ static uint64_t intervalStartTimeMs;
 static int lastIntervalLossPercentage;
 static int lastConnectionStatusUpdate;
 
+// Loss recovery state shared by the video receive thread, the decoder and
+// the thread sending recovery requests. Lost frame ranges are merged into a
+// single pending RFI request, and only one IDR frame is requested at a time.
+static PLT_MUTEX recoveryMutex;
 static int idrFrameRequired;
-static LINKED_BLOCKING_QUEUE invalidReferenceFrameTuples;
+static int rfiPending;
+static int rfiStartFrame;
+static int rfiEndFrame;
+static int rfiOutstanding;
+static int rfiOutstandingStartFrame;
+static int rfiOutstandingEndFrame;
+static uint64_t rfiRequestTimeMs;
+static uint64_t rfiRecoveryTimeMs;
+static int idrOutstanding;
+static uint64_t idrRequestTimeMs;
+static uint64_t lossTimeMs;
+static LOSS_RECOVERY_STATS recoveryStats;
+static uint64_t totalRecoveryTimeMs;
 
 #define CONN_IMMEDIATE_POOR_LOSS_RATE 30
 #define CONN_CONSECUTIVE_POOR_LOSS_RATE 15
@@ -169,13 +216,35 @@ static char**preconstructedPayloads;
 
 #define LOSS_REPORT_INTERVAL_MS 50
 #define PERIODIC_PING_INTERVAL_MS 250
+#define ENET_MESSAGE_QUEUE_SIZE 128
+#define ENET_MAX_WAIT_MS 100
+
+// An RFI request that hasn't produced a complete frame within this time
+// is escalated to an IDR frame request
+#define RFI_RECOVERY_TIMEOUT_MS 500
+
+// Further IDR frame requests are suppressed for this long after one is sent
+// unless the IDR frame arrives first
+#define IDR_RETRY_TIMEOUT_MS 1000
+
+// Replies slower than this are logged
+#define SLOW_REPLY_THRESHOLD_MS 1000
 
 // Initializes the control stream
 int initializeControlStream(void) {
     stopping = 0;
     PltCreateEvent(&invalidateRefFramesEvent);
-    LbqInitializeLinkedBlockingQueue(&invalidReferenceFrameTuples, 20);
-    PltCreateMutex(&enetMutex);
+    PltCreateMutex(&recoveryMutex);
+    PltCreateMutex(&outstandingRequestMutex);
+    PltCreateMutex(&linkStatsMutex);
+    memset(&linkStats, 0, sizeof(linkStats));
+    haveLinkStats = 0;
+    lastPeerPacketsSent = 0;
+    lastPeerPacketsLost = 0;
+    outstandingRequestHead = 0;
+    outstandingRequestCount = 0;
+    MpscInitializeQueue(&enetMessageQueue, ENET_MESSAGE_QUEUE_SIZE, sizeof(QUEUED_ENET_MESSAGE));
+    wakePending = 0;
 
     if (AppVersionQuad[0] == 3) {
         packetTypes = (short*)packetTypesGen3;
@@ -199,6 +268,12 @@ int initializeControlStream(void) {
     }
 
     idrFrameRequired = 0;
+    rfiPending = 0;
+    rfiOutstanding = 0;
+    idrOutstanding = 0;
+    lossTimeMs = 0;
+    memset(&recoveryStats, 0, sizeof(recoveryStats));
+    totalRecoveryTimeMs = 0;
     lastGoodFrame = 0;
     lastSeenFrame = 0;
     lossCountSinceLastReport = 0;
@@ -215,59 +290,117 @@ int initializeControlStream(void) {
     return 0;
 }
 
-void freeFrameInvalidationList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
-    PLINKED_BLOCKING_QUEUE_ENTRY nextEntry;
-
-    while (entry != NULL) {
-        nextEntry = entry->flink;
-        free(entry->data);
-        entry = nextEntry;
-    }
-}
-
 // Cleans up control stream
 void destroyControlStream(void) {
     LC_ASSERT(stopping);
     PltCloseEvent(&invalidateRefFramesEvent);
-    freeFrameInvalidationList(LbqDestroyLinkedBlockingQueue(&invalidReferenceFrameTuples));
-    PltDeleteMutex(&enetMutex);
+    PltDeleteMutex(&recoveryMutex);
+    PltDeleteMutex(&outstandingRequestMutex);
+    PltDeleteMutex(&linkStatsMutex);
+    MpscDestroyQueue(&enetMessageQueue);
+}
+
+// Must be called with recoveryMutex held
+static void noteLossTime(void) {
+    if (lossTimeMs == 0) {
+        lossTimeMs = PltGetMillis();
+    }
+}
+
+// Must be called with recoveryMutex held
+static void recordRecovery(void) {
+    if (lossTimeMs != 0) {
+        unsigned int recoveryTimeMs = (unsigned int)(PltGetMillis() - lossTimeMs);
+
+        recoveryStats.recoveries++;
+        recoveryStats.lastRecoveryTimeMs = recoveryTimeMs;
+        if (recoveryTimeMs > recoveryStats.maxRecoveryTimeMs) {
+            recoveryStats.maxRecoveryTimeMs = recoveryTimeMs;
+        }
+        totalRecoveryTimeMs += recoveryTimeMs;
+        lossTimeMs = 0;
+    }
 }
 
-int getNextFrameInvalidationTuple(PQUEUED_FRAME_INVALIDATION_TUPLE* qfit) {
-    int err = LbqPollQueueElement(&invalidReferenceFrameTuples, (void**)qfit);
-    return (err == LBQ_SUCCESS);
+// Must be called with recoveryMutex held. Returns 1 if the request
+// thread needs to be woken up.
+static int requestIdrFrameLocked(void) {
+    noteLossTime();
+
+    // An IDR frame will fix whatever the new request was for, so
+    // there's no need to ask again until it's had time to arrive
+    if (idrFrameRequired ||
+            (idrOutstanding && PltGetMillis() - idrRequestTimeMs < IDR_RETRY_TIMEOUT_MS)) {
+        recoveryStats.suppressedIdrRequests++;
+        return 0;
+    }
+
+    idrFrameRequired = 1;
+    rfiPending = 0;
+    return 1;
 }
 
 void queueFrameInvalidationTuple(int startFrame, int endFrame) {
+    int wake;
+
     LC_ASSERT(startFrame <= endFrame);
-    
-    if (isReferenceFrameInvalidationEnabled()) {
-        PQUEUED_FRAME_INVALIDATION_TUPLE qfit;
-        qfit = malloc(sizeof(*qfit));
-        if (qfit != NULL) {
-            qfit->startFrame = startFrame;
-            qfit->endFrame = endFrame;
-            if (LbqOfferQueueItem(&invalidReferenceFrameTuples, qfit, &qfit->entry) == LBQ_BOUND_EXCEEDED) {
-                // Too many invalidation tuples, so we need an IDR frame now
-                free(qfit);
-                idrFrameRequired = 1;
-            }
+
+    PltLockMutex(&recoveryMutex);
+
+    if (!isReferenceFrameInvalidationEnabled()) {
+        wake = requestIdrFrameLocked();
+    }
+    else if (idrFrameRequired || idrOutstanding) {
+        // The IDR frame we're waiting for will also replace these frames
+        noteLossTime();
+        recoveryStats.coalescedRfiRanges++;
+        wake = 0;
+    }
+    else if (rfiOutstanding && !rfiPending &&
+             !isBefore32(startFrame, rfiOutstandingStartFrame) &&
+             !isBefore32(rfiOutstandingEndFrame, endFrame)) {
+        // The FEC queue may have already reported these frames before the
+        // depacketizer noticed them missing
+        recoveryStats.coalescedRfiRanges++;
+        wake = 0;
+    }
+    else if (rfiPending) {
+        // Merge this range with the one that hasn't been sent yet
+        if (isBefore32(startFrame, rfiStartFrame)) {
+            rfiStartFrame = startFrame;
         }
-        else {
-            idrFrameRequired = 1;
+        if (isBefore32(rfiEndFrame, endFrame)) {
+            rfiEndFrame = endFrame;
         }
+        recoveryStats.coalescedRfiRanges++;
+        wake = 0;
     }
     else {
-        idrFrameRequired = 1;
+        noteLossTime();
+        rfiPending = 1;
+        rfiStartFrame = startFrame;
+        rfiEndFrame = endFrame;
+        wake = 1;
     }
 
-    PltSetEvent(&invalidateRefFramesEvent);
+    PltUnlockMutex(&recoveryMutex);
+
+    if (wake) {
+        PltSetEvent(&invalidateRefFramesEvent);
+    }
 }
 
 // Request an IDR frame on demand by the decoder
 void requestIdrOnDemand(void) {
-    idrFrameRequired = 1;
-    PltSetEvent(&invalidateRefFramesEvent);
+    int wake;
+
+    PltLockMutex(&recoveryMutex);
+    wake = requestIdrFrameLocked();
+    PltUnlockMutex(&recoveryMutex);
+
+    if (wake) {
+        PltSetEvent(&invalidateRefFramesEvent);
+    }
 }
 
 // Invalidate reference frames lost by the network
@@ -276,9 +409,70 @@ void connectionDetectedFrameLoss(int startFrame, int endFrame) {
 }
 
 // When we receive a frame, update the number of our current frame
-void connectionReceivedCompleteFrame(int frameIndex) {
+void connectionReceivedCompleteFrame(int frameIndex, int isIdrFrame, uint64_t receiveTimeMs) {
     lastGoodFrame = frameIndex;
     intervalGoodFrameCount++;
+
+    PltLockMutex(&recoveryMutex);
+    if (isIdrFrame) {
+        if (idrOutstanding) {
+            idrOutstanding = 0;
+            rfiOutstanding = 0;
+            recordRecovery();
+        }
+    }
+    else if (rfiOutstanding && !idrOutstanding && !idrFrameRequired &&
+             isBefore32(rfiOutstandingEndFrame, frameIndex) &&
+             receiveTimeMs >= rfiRecoveryTimeMs) {
+        // Frames the host encoded before it saw the request may still
+        // reference the lost frames, so only a complete frame that started
+        // arriving a round trip after the request means the host is encoding
+        // against valid references again.
+        rfiOutstanding = 0;
+        if (!rfiPending) {
+            recordRecovery();
+        }
+    }
+    PltUnlockMutex(&recoveryMutex);
+}
+
+// Escalates RFI requests that haven't led to a complete frame and repeats
+// IDR frame requests that went unanswered. This runs on the loss stats
+// thread since it already wakes up periodically.
+static void checkLossRecoveryTimeouts(void) {
+    uint64_t now = PltGetMillis();
+    int wake = 0;
+
+    PltLockMutex(&recoveryMutex);
+    if (rfiOutstanding && !idrOutstanding && !idrFrameRequired &&
+            now - rfiRequestTimeMs >= RFI_RECOVERY_TIMEOUT_MS) {
+        Limelog("Reference frame invalidation timed out; requesting IDR frame\n");
+        rfiOutstanding = 0;
+        rfiPending = 0;
+        idrFrameRequired = 1;
+        recoveryStats.escalatedRfiRequests++;
+        wake = 1;
+    }
+    else if (idrOutstanding && !idrFrameRequired &&
+             now - idrRequestTimeMs >= IDR_RETRY_TIMEOUT_MS) {
+        Limelog("IDR frame not received; requesting another\n");
+        idrFrameRequired = 1;
+        wake = 1;
+    }
+    PltUnlockMutex(&recoveryMutex);
+
+    if (wake) {
+        PltSetEvent(&invalidateRefFramesEvent);
+    }
+}
+
+void LiGetLossRecoveryStats(PLOSS_RECOVERY_STATS stats) {
+    PltLockMutex(&recoveryMutex);
+    *stats = recoveryStats;
+    if (recoveryStats.recoveries != 0) {
+        stats->averageRecoveryTimeMs = (unsigned int)(totalRecoveryTimeMs / recoveryStats.recoveries);
+    }
+    PltUnlockMutex(&recoveryMutex);
 }
 
 void connectionSawFrame(int frameIndex) {
@@ -312,9 +506,10 @@ void connectionSawFrame(int frameIndex) {
     lastSeenFrame = frameIndex;
 }
 
-// When we lose packets, update our packet loss count
-void connectionLostPackets(int lastReceivedPacket, int nextReceivedPacket) {
-    lossCountSinceLastReport += (nextReceivedPacket - lastReceivedPacket) - 1;
+// Called by the video stream when packets were lost and couldn't be recovered.
+// This runs on the video receive thread while the loss stats thread reads it.
+void connectionLostPackets(int lostPackets) {
+    PltAtomicFetchAdd(&lossCountSinceLastReport, lostPackets);
 }
 
 // Reads an NV control stream packet from the TCP connection
@@ -345,34 +540,51 @@ static PNVCTL_TCP_PACKET_HEADER readNvctlPacketTcp(void) {
     return fullPacket;
 }
 
-static int sendMessageEnet(short ptype, short paylen, const void* payload) {
+// Wakes the control stream thread to send queued messages
+static void wakeControlStreamThread(void) {
+    char wakeByte = 0;
+
+    // Only one wakeup is needed until the thread drains the queue
+    if (PltAtomicCompareExchange(&wakePending, 0, 1)) {
+        send(wakeSock, &wakeByte, sizeof(wakeByte), 0);
+    }
+}
+
+// Queues a message to be sent by the control stream thread the next time
+// it wakes up. inputEnqueueTimeUs is 0 unless this is an input packet.
+static int queueMessageEnet(short ptype, short paylen, const void* payload, uint64_t inputEnqueueTimeUs) {
     PNVCTL_ENET_PACKET_HEADER packet;
-    ENetPacket* enetPacket;
+    QUEUED_ENET_MESSAGE message;
     int err;
 
     LC_ASSERT(AppVersionQuad[0] >= 5);
 
-    enetPacket = enet_packet_create(NULL, sizeof(*packet) + paylen, ENET_PACKET_FLAG_RELIABLE);
-    if (enetPacket == NULL) {
+    message.packet = enet_packet_create(NULL, sizeof(*packet) + paylen, ENET_PACKET_FLAG_RELIABLE);
+    if (message.packet == NULL) {
         return 0;
     }
+    message.inputEnqueueTimeUs = inputEnqueueTimeUs;
 
-    packet = (PNVCTL_ENET_PACKET_HEADER)enetPacket->data;
+    packet = (PNVCTL_ENET_PACKET_HEADER)message.packet->data;
     packet->type = ptype;
     memcpy(&packet[1], payload, paylen);
 
-    PltLockMutex(&enetMutex);
-    err = enet_peer_send(peer, 0, enetPacket);
-    PltUnlockMutex(&enetMutex);
-    if (err < 0) {
-        Limelog("Failed to send ENet control packet\n");
-        enet_packet_destroy(enetPacket);
+    err = MpscOfferItem(&enetMessageQueue, &message, NULL);
+    if (err != LBQ_SUCCESS) {
+        Limelog("Failed to queue ENet control packet: %d\n", err);
+        enet_packet_destroy(message.packet);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int sendMessageEnet(short ptype, short paylen, const void* payload) {
+    if (!queueMessageEnet(ptype, paylen, payload, 0)) {
         return 0;
     }
-    
-    PltLockMutex(&enetMutex);
-    enet_host_flush(client);
-    PltUnlockMutex(&enetMutex);
+
+    wakeControlStreamThread();
 
     return 1;
 }
@@ -406,7 +618,7 @@ static int sendMessageAndForget(short ptype, short paylen, const void* payload)
     int ret;
 
     // Unlike regular sockets, ENet sockets aren't safe to invoke from multiple
-    // threads at once. We have to synchronize them with a lock.
+    // threads at once. ENet messages are handed to the control stream thread.
     if (AppVersionQuad[0] >= 5) {
         ret = sendMessageEnet(ptype, paylen, payload);
     }
@@ -417,6 +629,8 @@ static int sendMessageAndForget(short ptype, short paylen, const void* payload)
     return ret;
 }
 
+// Sends a message that the host will reply to without waiting for the reply.
+// The control receive thread consumes the reply when it arrives.
 static int sendMessageAndDiscardReply(short ptype, short paylen, const void* payload) {
     if (AppVersionQuad[0] >= 5) {
         if (!sendMessageEnet(ptype, paylen, payload)) {
@@ -424,22 +638,73 @@ static int sendMessageAndDiscardReply(short ptype, short paylen, const void* pay
         }
     }
     else {
-        PNVCTL_TCP_PACKET_HEADER reply;
+        int ret;
+
+        // Hold the lock across the send so requests are tracked in the
+        // same order that they go out on the wire
+        PltLockMutex(&outstandingRequestMutex);
+        ret = sendMessageTcp(ptype, paylen, payload);
+        if (ret) {
+            if (outstandingRequestCount < MAX_OUTSTANDING_REQUESTS) {
+                POUTSTANDING_REQUEST request =
+                    &outstandingRequests[(outstandingRequestHead + outstandingRequestCount) % MAX_OUTSTANDING_REQUESTS];
+
+                request->type = ptype;
+                request->sendTimeMs = PltGetMillis();
+                outstandingRequestCount++;
+            }
+            else {
+                Limelog("Too many outstanding control requests; not tracking 0x%04x\n", (unsigned short)ptype);
+            }
+        }
+        PltUnlockMutex(&outstandingRequestMutex);
 
-        if (!sendMessageTcp(ptype, paylen, payload)) {
+        if (!ret) {
             return 0;
         }
+    }
+
+    return 1;
+}
+
+// Matches a reply received over TCP with the oldest outstanding request
+static void handleTcpReply(PNVCTL_TCP_PACKET_HEADER reply) {
+    PltLockMutex(&outstandingRequestMutex);
+    if (outstandingRequestCount > 0) {
+        POUTSTANDING_REQUEST request = &outstandingRequests[outstandingRequestHead];
+        unsigned int replyTimeMs = (unsigned int)(PltGetMillis() - request->sendTimeMs);
+
+        if (replyTimeMs >= SLOW_REPLY_THRESHOLD_MS) {
+            Limelog("Control stream reply to 0x%04x took %u ms\n", (unsigned short)request->type, replyTimeMs);
+        }
+
+        outstandingRequestHead = (outstandingRequestHead + 1) % MAX_OUTSTANDING_REQUESTS;
+        outstandingRequestCount--;
+    }
+    else {
+        Limelog("Discarding unexpected control stream reply: 0x%04x\n", reply->type);
+    }
+    PltUnlockMutex(&outstandingRequestMutex);
+}
+
+// Consumes replies to requests sent over TCP
+static void tcpReceiveLoop(void) {
+    while (!PltIsThreadInterrupted(&controlReceiveThread)) {
+        PNVCTL_TCP_PACKET_HEADER reply;
 
-        // Discard the response
         reply = readNvctlPacketTcp();
         if (reply == NULL) {
-            return 0;
+            // The socket is shut down when we're stopping
+            if (!stopping) {
+                Limelog("Control stream receive failed: %d\n", (int)LastSocketError());
+                ListenerCallbacks.connectionTerminated(LastSocketFail());
+            }
+            return;
         }
 
+        handleTcpReply(reply);
         free(reply);
     }
-
-    return 1;
 }
 
 // This intercept function drops disconnect events to allow us to process
@@ -463,26 +728,218 @@ static int ignoreDisconnectIntercept(ENetHost* host, ENetEvent* event) {
     return 0;
 }
 
+// Creates a UDP socket on the loopback interface that is connected to itself.
+// Other threads send a byte on it to wake the control stream thread.
+static SOCKET createWakeSocket(void) {
+    SOCKET s;
+    struct sockaddr_in addr;
+    SOCKADDR_LEN addrLen;
+    int err;
+
+    s = createSocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, 1);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addrLen = sizeof(addr);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(s, (struct sockaddr*)&addr, &addrLen) == SOCKET_ERROR ||
+        connect(s, (struct sockaddr*)&addr, addrLen) == SOCKET_ERROR) {
+        err = LastSocketError();
+        Limelog("Failed to create wake socket: %d\n", err);
+        closeSocket(s);
+        SetLastSocketError(err);
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+// Hands messages queued by other threads to ENet and flushes them.
+// This must only be called on the control stream thread.
+static void sendQueuedEnetMessages(void) {
+    QUEUED_ENET_MESSAGE message;
+    uint64_t inputEnqueueTimesUs[ENET_MESSAGE_QUEUE_SIZE];
+    int inputCount;
+    char wakeBuffer[16];
+    int sent;
+
+    // Consume the wakeups before rearming them, so any message queued after
+    // the queue is drained below will wake us again
+    while (recv(wakeSock, wakeBuffer, sizeof(wakeBuffer), 0) > 0);
+    PltAtomicStore(&wakePending, 0);
+
+    sent = 0;
+    inputCount = 0;
+    while (MpscPollItem(&enetMessageQueue, &message) == LBQ_SUCCESS) {
+        if (enet_peer_send(peer, 0, message.packet) < 0) {
+            Limelog("Failed to send ENet control packet\n");
+            enet_packet_destroy(message.packet);
+            continue;
+        }
+
+        sent = 1;
+        if (message.inputEnqueueTimeUs != 0) {
+            inputEnqueueTimesUs[inputCount++] = message.inputEnqueueTimeUs;
+
+            // Flush early if messages keep arriving while we drain the queue
+            if (inputCount == ENET_MESSAGE_QUEUE_SIZE) {
+                enet_host_flush(client);
+                recordSentInputPackets(inputEnqueueTimesUs, inputCount);
+                sent = 0;
+                inputCount = 0;
+            }
+        }
+    }
+
+    if (sent) {
+        enet_host_flush(client);
+
+        // Input send times are measured up to the flush
+        if (inputCount != 0) {
+            recordSentInputPackets(inputEnqueueTimesUs, inputCount);
+        }
+    }
+}
+
+// Returns how long we can wait before ENet must be serviced to retransmit
+// unacknowledged reliable commands or to send a keepalive ping
+static int getEnetServiceTimeoutMs(void) {
+    enet_uint32 now = enet_time_get();
+    enet_uint32 deadline;
+
+    if (!enet_list_empty(&peer->sentReliableCommands)) {
+        // The retransmission timeout of the oldest unacknowledged command
+        deadline = peer->nextTimeout;
+    }
+    else {
+        // ENet pings an idle peer once nothing has been received for a ping interval
+        deadline = peer->lastReceiveTime + peer->pingInterval;
+    }
+
+    if (ENET_TIME_GREATER_EQUAL(now, deadline)) {
+        return 0;
+    }
+    else if (ENET_TIME_DIFFERENCE(deadline, now) > ENET_MAX_WAIT_MS) {
+        return ENET_MAX_WAIT_MS;
+    }
+    else {
+        return (int)ENET_TIME_DIFFERENCE(deadline, now);
+    }
+}
+
+// Waits until the ENet socket is readable, another thread has queued
+// a message, or the timeout expires
+static void waitForEnetActivity(int timeoutMs) {
+    struct pollfd pfds[2];
+
+    pfds[0].fd = client->socket;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = wakeSock;
+    pfds[1].events = POLLIN;
+
+    pollSockets(pfds, 2, timeoutMs);
+}
+
+// Disconnects and destroys the ENet host once the control stream thread is gone
+static void destroyEnetHost(void) {
+    QUEUED_ENET_MESSAGE message;
+
+    // Free any messages that never made it to ENet
+    while (MpscPollItem(&enetMessageQueue, &message) == LBQ_SUCCESS) {
+        enet_packet_destroy(message.packet);
+    }
+
+    if (peer != NULL) {
+        // We use enet_peer_disconnect_now() so the host knows immediately
+        // of our termination and can cleanup properly for reconnection.
+        enet_peer_disconnect_now(peer, 0);
+        peer = NULL;
+    }
+    if (client != NULL) {
+        enet_host_destroy(client);
+        client = NULL;
+    }
+    if (wakeSock != INVALID_SOCKET) {
+        closeSocket(wakeSock);
+        wakeSock = INVALID_SOCKET;
+    }
+}
+
+// ENet resets its packet counters each time it updates its loss estimate,
+// so accumulate the change since the last snapshot
+static unsigned int getPeerCounterDelta(enet_uint32 value, enet_uint32* lastValue) {
+    unsigned int delta = value >= *lastValue ? value - *lastValue : value;
+
+    *lastValue = value;
+    return delta;
+}
+
+// Called by the control stream thread before it waits for ENet activity
+static void updateControlLinkStats(void) {
+    PltLockMutex(&linkStatsMutex);
+    linkStats.rttMs = peer->roundTripTime;
+    linkStats.rttVarianceMs = peer->roundTripTimeVariance;
+    linkStats.lowestRttMs = peer->lowestRoundTripTime;
+    linkStats.sentPackets += getPeerCounterDelta(peer->packetsSent, &lastPeerPacketsSent);
+    linkStats.retransmittedPackets += getPeerCounterDelta(peer->packetsLost, &lastPeerPacketsLost);
+    linkStats.packetLossPerMille = (unsigned int)((unsigned long long)peer->packetLoss * 1000 / ENET_PEER_PACKET_LOSS_SCALE);
+    linkStats.packetThrottlePercent = peer->packetThrottle * 100 / ENET_PEER_PACKET_THROTTLE_SCALE;
+    haveLinkStats = 1;
+    PltUnlockMutex(&linkStatsMutex);
+}
+
+int LiGetControlLinkStats(PCONTROL_LINK_STATS stats) {
+    int ret;
+
+    PltLockMutex(&linkStatsMutex);
+    if (haveLinkStats) {
+        *stats = linkStats;
+        ret = 0;
+    }
+    else {
+        memset(stats, 0, sizeof(*stats));
+        ret = -1;
+    }
+    PltUnlockMutex(&linkStatsMutex);
+
+    return ret;
+}
+
+// Returns the control stream's round trip time, or 0 if it's not known
+static unsigned int getControlRttMs(void) {
+    unsigned int rttMs;
+
+    PltLockMutex(&linkStatsMutex);
+    rttMs = haveLinkStats ? linkStats.rttMs : 0;
+    PltUnlockMutex(&linkStatsMutex);
+
+    return rttMs;
+}
+
 static void controlReceiveThreadFunc(void* context) {
     int err;
 
-    // This is only used for ENet
     if (AppVersionQuad[0] < 5) {
+        tcpReceiveLoop();
         return;
     }
 
     while (!PltIsThreadInterrupted(&controlReceiveThread)) {
         ENetEvent event;
 
+        // Send messages from other threads before servicing the host
+        sendQueuedEnetMessages();
+
         // Poll for new packets and process retransmissions
-        PltLockMutex(&enetMutex);
         err = serviceEnetHost(client, &event, 0);
-        PltUnlockMutex(&enetMutex);
         if (err == 0) {
             // Handle a pending disconnect after unsuccessfully polling
             // for new events to handle.
             if (disconnectPending) {
-                PltLockMutex(&enetMutex);
                 // Wait 100 ms for pending receives after a disconnect and
                 // 1 second for the pending disconnect to be processed after
                 // removing the intercept callback.
@@ -495,30 +952,25 @@ static void controlReceiveThreadFunc(void* context) {
                         // 1 second for this disconnect to be processed before
                         // we tear down the connection anyway.
                         client->intercept = NULL;
-                        PltUnlockMutex(&enetMutex);
                         continue;
                     }
                     else {
                         // The 1 second timeout has expired with no disconnect event
                         // retransmission after the first notification. We can only
                         // assume the server died tragically, so go ahead and tear down.
-                        PltUnlockMutex(&enetMutex);
                         Limelog("Disconnect event timeout expired\n");
                         ListenerCallbacks.connectionTerminated(-1);
                         return;
                     }
                 }
-                else {
-                    PltUnlockMutex(&enetMutex);
-                }
             }
             else {
-                // No events ready - sleep for a short time
-                //
-                // NOTE: This sleep *directly* impacts the lowest possible retransmission
-                // time for packets after a loss event. If we're busy sleeping here, we can't
-                // retransmit a dropped packet, so we keep the sleep time to a minimum.
-                PltSleepMsInterruptible(&controlReceiveThread, 10);
+                // No events ready - wait until ENet's next retransmission or
+                // ping is due. Incoming packets and messages queued by other
+                // threads end the wait early, so lost packets are retransmitted
+                // on time and we don't wake up needlessly while idle.
+                updateControlLinkStats();
+                waitForEnetActivity(getEnetServiceTimeoutMs());
                 continue;
             }
         }
@@ -614,12 +1066,15 @@ static void lossStatsThreadFunc(void* context) {
                 return;
             }
 
+            checkLossRecoveryTimeouts();
+
             // Wait a bit
             PltSleepMsInterruptible(&lossStatsThread, PERIODIC_PING_INTERVAL_MS);
         }
     }
     else {
         char* lossStatsPayload;
+        int lossCount;
 
         lossStatsPayload = malloc(payloadLengths[IDX_LOSS_STATS]);
         if (lossStatsPayload == NULL) {
@@ -630,8 +1085,9 @@ static void lossStatsThreadFunc(void* context) {
 
         while (!PltIsThreadInterrupted(&lossStatsThread)) {
             // Construct the payload
+            lossCount = PltAtomicLoad(&lossCountSinceLastReport);
             BbInitializeWrappedBuffer(&byteBuffer, lossStatsPayload, 0, payloadLengths[IDX_LOSS_STATS], BYTE_ORDER_LITTLE);
-            BbPutInt(&byteBuffer, lossCountSinceLastReport);
+            BbPutInt(&byteBuffer, lossCount);
             BbPutInt(&byteBuffer, LOSS_REPORT_INTERVAL_MS);
             BbPutInt(&byteBuffer, 1000);
             BbPutLong(&byteBuffer, lastGoodFrame);
@@ -648,8 +1104,10 @@ static void lossStatsThreadFunc(void* context) {
                 return;
             }
 
-            // Clear the transient state
-            lossCountSinceLastReport = 0;
+            // Clear the transient state without dropping losses counted since we read it
+            PltAtomicFetchAdd(&lossCountSinceLastReport, -lossCount);
+
+            checkLossRecoveryTimeouts();
 
             // Wait a bit
             PltSleepMsInterruptible(&lossStatsThread, LOSS_REPORT_INTERVAL_MS);
@@ -696,29 +1154,15 @@ static void requestIdrFrame(void) {
     Limelog("IDR frame request sent\n");
 }
 
-static void requestInvalidateReferenceFrames(void) {
+static void requestInvalidateReferenceFrames(int startFrame, int endFrame) {
     long long payload[3];
-    PQUEUED_FRAME_INVALIDATION_TUPLE qfit;
 
     LC_ASSERT(isReferenceFrameInvalidationEnabled());
 
-    if (!getNextFrameInvalidationTuple(&qfit)) {
-        return;
-    }
-
-    LC_ASSERT(qfit->startFrame <= qfit->endFrame);
-
-    payload[0] = qfit->startFrame;
-    payload[1] = qfit->endFrame;
+    payload[0] = startFrame;
+    payload[1] = endFrame;
     payload[2] = 0;
 
-    // Aggregate all lost frames into one range
-    do {
-        LC_ASSERT(qfit->endFrame >= payload[1]);
-        payload[1] = qfit->endFrame;
-        free(qfit);
-    } while (getNextFrameInvalidationTuple(&qfit));
-
     // Send the reference frame invalidation request and read the response
     if (!sendMessageAndDiscardReply(packetTypes[IDX_INVALIDATE_REF_FRAMES],
         payloadLengths[IDX_INVALIDATE_REF_FRAMES], payload)) {
@@ -727,11 +1171,17 @@ static void requestInvalidateReferenceFrames(void) {
         return;
     }
 
-    Limelog("Invalidate reference frame request sent (%d to %d)\n", (int)payload[0], (int)payload[1]);
+    Limelog("Invalidate reference frame request sent (%d to %d)\n", startFrame, endFrame);
 }
 
 static void invalidateRefFramesFunc(void* context) {
     while (!PltIsThreadInterrupted(&invalidateRefFramesThread)) {
+        int sendIdrRequest = 0;
+        int sendRfiRequest = 0;
+        int startFrame = 0;
+        int endFrame = 0;
+        unsigned int rttMs;
+
         // Wait for a request to invalidate reference frames
         PltWaitForEvent(&invalidateRefFramesEvent);
         PltClearEvent(&invalidateRefFramesEvent);
@@ -741,21 +1191,40 @@ static void invalidateRefFramesFunc(void* context) {
             break;
         }
 
-        // Sometimes we absolutely need an IDR frame
-        if (idrFrameRequired) {
-            // Empty invalidate reference frames tuples
-            PQUEUED_FRAME_INVALIDATION_TUPLE qfit;
-            while (getNextFrameInvalidationTuple(&qfit)) {
-                free(qfit);
-            }
+        rttMs = getControlRttMs();
 
-            // Send an IDR frame request
+        PltLockMutex(&recoveryMutex);
+        if (idrFrameRequired) {
+            // Sometimes we absolutely need an IDR frame. It replaces
+            // any reference frame invalidation we were going to send.
             idrFrameRequired = 0;
+            rfiPending = 0;
+            rfiOutstanding = 0;
+            idrOutstanding = 1;
+            idrRequestTimeMs = PltGetMillis();
+            recoveryStats.idrRequests++;
+            sendIdrRequest = 1;
+        }
+        else if (rfiPending) {
+            // Otherwise invalidate the merged range of lost frames
+            startFrame = rfiStartFrame;
+            endFrame = rfiEndFrame;
+            rfiPending = 0;
+            rfiOutstanding = 1;
+            rfiOutstandingStartFrame = startFrame;
+            rfiOutstandingEndFrame = endFrame;
+            rfiRequestTimeMs = PltGetMillis();
+            rfiRecoveryTimeMs = rfiRequestTimeMs + rttMs;
+            recoveryStats.rfiRequests++;
+            sendRfiRequest = 1;
+        }
+        PltUnlockMutex(&recoveryMutex);
+
+        if (sendIdrRequest) {
             requestIdrFrame();
         }
-        else {
-            // Otherwise invalidate reference frames
-            requestInvalidateReferenceFrames();
+        else if (sendRfiRequest) {
+            requestInvalidateReferenceFrames(startFrame, endFrame);
         }
     }
 }
@@ -763,7 +1232,7 @@ static void invalidateRefFramesFunc(void* context) {
 // Stops the control stream
 int stopControlStream(void) {
     stopping = 1;
-    LbqSignalQueueShutdown(&invalidReferenceFrameTuples);
+    MpscSignalQueueShutdown(&enetMessageQueue);
     PltSetEvent(&invalidateRefFramesEvent);
 
     // This must be set to stop in a timely manner
@@ -777,6 +1246,12 @@ int stopControlStream(void) {
     PltInterruptThread(&invalidateRefFramesThread);
     PltInterruptThread(&controlReceiveThread);
 
+    // Wake the control stream thread if it's waiting for ENet activity
+    if (wakeSock != INVALID_SOCKET) {
+        PltAtomicStore(&wakePending, 0);
+        wakeControlStreamThread();
+    }
+
     PltJoinThread(&lossStatsThread);
     PltJoinThread(&invalidateRefFramesThread);
     PltJoinThread(&controlReceiveThread);
@@ -785,17 +1260,8 @@ int stopControlStream(void) {
     PltCloseThread(&invalidateRefFramesThread);
     PltCloseThread(&controlReceiveThread);
 
-    if (peer != NULL) {
-        // We use enet_peer_disconnect_now() so the host knows immediately
-        // of our termination and can cleanup properly for reconnection.
-        enet_peer_disconnect_now(peer, 0);
-        peer = NULL;
-    }
-    if (client != NULL) {
-        enet_host_destroy(client);
-        client = NULL;
-    }
-    
+    destroyEnetHost();
+
     if (ctlSock != INVALID_SOCKET) {
         closeSocket(ctlSock);
         ctlSock = INVALID_SOCKET;
@@ -805,13 +1271,19 @@ int stopControlStream(void) {
 }
 
 // Called by the input stream to send a packet for Gen 5+ servers
-int sendInputPacketOnControlStream(unsigned char* data, int length) {
+// If moreData is set, the packet is held until the last packet of the batch
+// is sent so they can share a datagram. The send time is recorded with the
+// input stream's statistics once ENet flushes the packet.
+int sendInputPacketOnControlStream(unsigned char* data, int length, int moreData, uint64_t enqueueTimeUs) {
     LC_ASSERT(AppVersionQuad[0] >= 5);
 
     // Send the input data (no reply expected)
-    if (sendMessageAndForget(packetTypes[IDX_INPUT_DATA], length, data) == 0) {
+    if (queueMessageEnet(packetTypes[IDX_INPUT_DATA], length, data, enqueueTimeUs) == 0) {
         return -1;
     }
+    if (!moreData) {
+        wakeControlStreamThread();
+    }
 
     return 0;
 }
@@ -862,6 +1334,14 @@ int startControlStream(void) {
         
         // Set the max peer timeout to 10 seconds
         enet_peer_timeout(peer, ENET_PEER_TIMEOUT_LIMIT, ENET_PEER_TIMEOUT_MINIMUM, 10000);
+
+        wakeSock = createWakeSocket();
+        if (wakeSock == INVALID_SOCKET) {
+            err = LastSocketFail();
+            stopping = 1;
+            destroyEnetHost();
+            return err;
+        }
     }
     else {
         ctlSock = connectTcpSocket(&RemoteAddr, RemoteAddrLen,
@@ -882,10 +1362,7 @@ int startControlStream(void) {
             ctlSock = INVALID_SOCKET;
         }
         else {
-            enet_peer_disconnect_now(peer, 0);
-            peer = NULL;
-            enet_host_destroy(client);
-            client = NULL;
+            destroyEnetHost();
         }
         return err;
     }
@@ -914,10 +1391,7 @@ int startControlStream(void) {
             ctlSock = INVALID_SOCKET;
         }
         else {
-            enet_peer_disconnect_now(peer, 0);
-            peer = NULL;
-            enet_host_destroy(client);
-            client = NULL;
+            destroyEnetHost();
         }
         return err;
     }
@@ -946,10 +1420,7 @@ int startControlStream(void) {
             ctlSock = INVALID_SOCKET;
         }
         else {
-            enet_peer_disconnect_now(peer, 0);
-            peer = NULL;
-            enet_host_destroy(client);
-            client = NULL;
+            destroyEnetHost();
         }
         return err;
     }
@@ -974,10 +1445,7 @@ int startControlStream(void) {
             ctlSock = INVALID_SOCKET;
         }
         else {
-            enet_peer_disconnect_now(peer, 0);
-            peer = NULL;
-            enet_host_destroy(client);
-            client = NULL;
+            destroyEnetHost();
         }
         return err;
     }
@@ -1006,10 +1474,7 @@ int startControlStream(void) {
             ctlSock = INVALID_SOCKET;
         }
         else {
-            enet_peer_disconnect_now(peer, 0);
-            peer = NULL;
-            enet_host_destroy(client);
-            client = NULL;
+            destroyEnetHost();
         }
 
         return err;
@@ -1,7 +1,8 @@
 #include "Limelight-internal.h"
 #include "PlatformSockets.h"
 #include "PlatformThreads.h"
-#include "LinkedBlockingQueue.h"
+#include "MpscQueue.h"
+#include "PlatformAtomics.h"
 #include "Input.h"
 
 #include <openssl/evp.h>
@@ -12,18 +13,51 @@ static int initialized;
 static EVP_CIPHER_CTX* cipherContext;
 static int cipherInitialized;
 
-static LINKED_BLOCKING_QUEUE packetQueue;
+static MPSC_QUEUE packetQueue;
 static PLT_THREAD inputSendThread;
 
+// Statistics updated by the threads calling LiSend*Event()
+static volatile int queuedEvents;
+static volatile int coalescedMouseMoveEvents;
+static volatile int coalescedMousePositionEvents;
+static volatile int coalescedControllerEvents;
+static volatile int coalescedScrollEvents;
+static volatile int droppedEvents;
+
+// Statistics updated by the input send thread, and by the control stream
+// thread once it flushes input packets on Gen 5+ servers
+static PLT_MUTEX sendStatsMutex;
+static INPUT_STATS sendStats;
+static uint64_t totalQueueTimeUs;
+static uint64_t totalSendTimeUs;
+
+// Devices whose updates can be merged together
+#define COALESCE_DEVICE_NONE -1
+#define COALESCE_DEVICE_MOUSE 0
+#define COALESCE_DEVICE_CONTROLLER(n) (1 + ((n) & 3))
+#define COALESCE_DEVICE_COUNT 5
+
+// Queue position plus one of the last packet queued for each device, or 0
+// if new updates for that device must not be merged into a queued packet
+static volatile unsigned int lastQueuedPosition[COALESCE_DEVICE_COUNT];
+
+// Used by the input send thread to enforce the coalescing window
+static uint64_t lastSendTimeMs[COALESCE_DEVICE_COUNT];
+static short lastSentButtonFlags[COALESCE_DEVICE_COUNT];
+
 #define MAX_INPUT_PACKET_SIZE 128
+#define INPUT_QUEUE_SIZE 32
+#define MAX_INPUT_BATCH_PACKETS 8
 #define INPUT_STREAM_TIMEOUT_SEC 10
 
 #define ROUND_TO_PKCS7_PADDED_LEN(x) ((((x) + 15) / 16) * 16)
 
 // Contains input stream packets
 typedef struct _PACKET_HOLDER {
+    uint64_t enqueueTimeUs;
     int packetLength;
     union {
+        NV_INPUT_HEADER header;
         NV_KEYBOARD_PACKET keyboard;
         NV_REL_MOUSE_MOVE_PACKET mouseMoveRel;
         NV_ABS_MOUSE_MOVE_PACKET mouseMoveAbs;
@@ -33,7 +67,6 @@ typedef struct _PACKET_HOLDER {
         NV_SCROLL_PACKET scroll;
         NV_HAPTICS_PACKET haptics;
     } packet;
-    LINKED_BLOCKING_QUEUE_ENTRY entry;
 } PACKET_HOLDER, *PPACKET_HOLDER;
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -42,35 +75,49 @@ typedef struct _PACKET_HOLDER {
 
 // Initializes the input stream
 int initializeInputStream(void) {
+    int err;
+
     memcpy(currentAesIv, StreamConfig.remoteInputAesIv, sizeof(currentAesIv));
     
     // Initialized on first packet
     cipherInitialized = 0;
-    
-    LbqInitializeLinkedBlockingQueue(&packetQueue, 30);
+
+    queuedEvents = 0;
+    coalescedMouseMoveEvents = 0;
+    coalescedMousePositionEvents = 0;
+    coalescedControllerEvents = 0;
+    coalescedScrollEvents = 0;
+    droppedEvents = 0;
+    memset(&sendStats, 0, sizeof(sendStats));
+    totalQueueTimeUs = 0;
+    totalSendTimeUs = 0;
+    memset((void*)lastQueuedPosition, 0, sizeof(lastQueuedPosition));
+    memset(lastSendTimeMs, 0, sizeof(lastSendTimeMs));
+    memset(lastSentButtonFlags, 0, sizeof(lastSentButtonFlags));
+
+    err = PltCreateMutex(&sendStatsMutex);
+    if (err != 0) {
+        return err;
+    }
+
+    err = MpscInitializeQueue(&packetQueue, INPUT_QUEUE_SIZE, sizeof(PACKET_HOLDER));
+    if (err != 0) {
+        PltDeleteMutex(&sendStatsMutex);
+        return err;
+    }
 
     return 0;
 }
 
 // Destroys and cleans up the input stream
 void destroyInputStream(void) {
-    PLINKED_BLOCKING_QUEUE_ENTRY entry, nextEntry;
-    
     if (cipherInitialized) {
         EVP_CIPHER_CTX_free(cipherContext);
         cipherInitialized = 0;
     }
 
-    entry = LbqDestroyLinkedBlockingQueue(&packetQueue);
-
-    while (entry != NULL) {
-        nextEntry = entry->flink;
-
-        // The entry is stored in the data buffer
-        free(entry->data);
-
-        entry = nextEntry;
-    }
+    MpscDestroyQueue(&packetQueue);
+    PltDeleteMutex(&sendStatsMutex);
 }
 
 static int addPkcs7PaddingInPlace(unsigned char* plaintext, int plaintextLen) {
@@ -96,23 +143,20 @@ static int encryptData(const unsigned char* plaintext, int plaintextLen,
                 return -1;
             }
             cipherInitialized = 1;
-        }
 
-        // Gen 7 servers use 128-bit AES GCM
-        if (EVP_EncryptInit_ex(cipherContext, EVP_aes_128_gcm(), NULL, NULL, NULL) != 1) {
-            ret = -1;
-            goto gcm_cleanup;
-        }
-        
-        // Gen 7 servers uses 16 byte IVs
-        if (EVP_CIPHER_CTX_ctrl(cipherContext, EVP_CTRL_GCM_SET_IVLEN, 16, NULL) != 1) {
-            ret = -1;
-            goto gcm_cleanup;
+            // Gen 7 servers use 128-bit AES GCM with 16 byte IVs. The key is
+            // only set once, so the key schedule is kept for the whole session.
+            if (EVP_EncryptInit_ex(cipherContext, EVP_aes_128_gcm(), NULL, NULL, NULL) != 1 ||
+                EVP_CIPHER_CTX_ctrl(cipherContext, EVP_CTRL_GCM_SET_IVLEN, 16, NULL) != 1 ||
+                EVP_EncryptInit_ex(cipherContext, NULL, NULL,
+                                   (const unsigned char*)StreamConfig.remoteInputAesKey, NULL) != 1) {
+                ret = -1;
+                goto gcm_cleanup;
+            }
         }
         
-        // Initialize again but now provide our key and current IV
-        if (EVP_EncryptInit_ex(cipherContext, NULL, NULL,
-                               (const unsigned char*)StreamConfig.remoteInputAesKey, currentAesIv) != 1) {
+        // Only provide the current IV. This restarts GCM without touching the key.
+        if (EVP_EncryptInit_ex(cipherContext, NULL, NULL, NULL, currentAesIv) != 1) {
             ret = -1;
             goto gcm_cleanup;
         }
@@ -139,10 +183,12 @@ static int encryptData(const unsigned char* plaintext, int plaintextLen,
         // Increment the ciphertextLen to account for the tag
         *ciphertextLen += 16;
         
-        ret = 0;
+        return 0;
         
     gcm_cleanup:
-        EVP_CIPHER_CTX_reset(cipherContext);
+        // Start over with a new context if anything went wrong
+        EVP_CIPHER_CTX_free(cipherContext);
+        cipherInitialized = 0;
     }
     else {
         unsigned char paddedData[MAX_INPUT_PACKET_SIZE];
@@ -182,195 +228,437 @@ static int encryptData(const unsigned char* plaintext, int plaintextLen,
     return ret;
 }
 
-// Input thread proc
-static void inputSendThreadProc(void* context) {
-    SOCK_RET err;
-    PPACKET_HOLDER holder;
-    char encryptedBuffer[MAX_INPUT_PACKET_SIZE];
-    int encryptedSize;
+// Returns the device whose packets may be coalesced with this packet
+static int getCoalescingDevice(PPACKET_HOLDER holder) {
+    switch (ntohl(holder->packet.header.packetType)) {
+    case PACKET_TYPE_REL_MOUSE_MOVE:
+    case PACKET_TYPE_ABS_MOUSE_MOVE:
+    case PACKET_TYPE_MOUSE_BUTTON:
+    case PACKET_TYPE_SCROLL:
+        return COALESCE_DEVICE_MOUSE;
+    case PACKET_TYPE_CONTROLLER:
+        return COALESCE_DEVICE_CONTROLLER(0);
+    case PACKET_TYPE_MULTI_CONTROLLER:
+        return COALESCE_DEVICE_CONTROLLER(holder->packet.multiController.controllerNumber);
+    default:
+        return COALESCE_DEVICE_NONE;
+    }
+}
 
-    while (!PltIsThreadInterrupted(&inputSendThread)) {
-        int encryptedLengthPrefix;
+// Merges a new packet into the last queued packet for the same device if
+// it's the same kind of update. This runs on the thread calling LiSend*Event().
+static int coalesceInputPackets(void* queuedItem, const void* newItem) {
+    PPACKET_HOLDER holder = (PPACKET_HOLDER)queuedItem;
+    const PACKET_HOLDER* newHolder = (const PACKET_HOLDER*)newItem;
 
-        err = LbqWaitForQueueElement(&packetQueue, (void**)&holder);
-        if (err != LBQ_SUCCESS) {
-            return;
+    if (holder->packet.header.packetType != newHolder->packet.header.packetType) {
+        return 0;
+    }
+
+    // Legacy controller packets follow the same rules as multi-controller packets
+    if (holder->packet.header.packetType == htonl(PACKET_TYPE_CONTROLLER)) {
+        PNV_CONTROLLER_PACKET origPkt = &holder->packet.controller;
+        const NV_CONTROLLER_PACKET* newPkt = &newHolder->packet.controller;
+
+        if (newPkt->buttonFlags != origPkt->buttonFlags) {
+            // Batching not allowed
+            return 0;
         }
 
-        // If it's a multi-controller packet we can do batching
-        if (holder->packet.multiController.header.packetType == htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
-            PPACKET_HOLDER controllerBatchHolder;
-            PNV_MULTI_CONTROLLER_PACKET origPkt;
+        // Update the original packet
+        origPkt->leftTrigger = newPkt->leftTrigger;
+        origPkt->rightTrigger = newPkt->rightTrigger;
+        origPkt->leftStickX = newPkt->leftStickX;
+        origPkt->leftStickY = newPkt->leftStickY;
+        origPkt->rightStickX = newPkt->rightStickX;
+        origPkt->rightStickY = newPkt->rightStickY;
+
+        PltAtomicFetchAdd(&coalescedControllerEvents, 1);
+        return 1;
+    }
+    // If it's a multi-controller packet we can do batching
+    else if (holder->packet.header.packetType == htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
+        PNV_MULTI_CONTROLLER_PACKET origPkt = &holder->packet.multiController;
+        const NV_MULTI_CONTROLLER_PACKET* newPkt = &newHolder->packet.multiController;
+
+        // Check if it's able to be batched
+        // NB: GFE does some discarding of gamepad packets received very soon after another.
+        // Thus, this batching is needed for correctness in some cases, as GFE will inexplicably
+        // drop *newer* packets in that scenario. The brokenness can be tested with consecutive
+        // calls to LiSendMultiControllerEvent() with different values for analog sticks (max -> zero).
+        if (newPkt->buttonFlags != origPkt->buttonFlags ||
+            newPkt->controllerNumber != origPkt->controllerNumber ||
+            newPkt->activeGamepadMask != origPkt->activeGamepadMask) {
+            // Batching not allowed
+            return 0;
+        }
 
-            origPkt = &holder->packet.multiController;
-            for (;;) {
-                PNV_MULTI_CONTROLLER_PACKET newPkt;
+        // Update the original packet
+        origPkt->leftTrigger = newPkt->leftTrigger;
+        origPkt->rightTrigger = newPkt->rightTrigger;
+        origPkt->leftStickX = newPkt->leftStickX;
+        origPkt->leftStickY = newPkt->leftStickY;
+        origPkt->rightStickX = newPkt->rightStickX;
+        origPkt->rightStickY = newPkt->rightStickY;
+
+        PltAtomicFetchAdd(&coalescedControllerEvents, 1);
+        return 1;
+    }
+    // If it's a relative mouse move packet, we can also do batching
+    else if (holder->packet.header.packetType == htonl(PACKET_TYPE_REL_MOUSE_MOVE)) {
+        int totalDeltaX = (short)htons(holder->packet.mouseMoveRel.deltaX);
+        int totalDeltaY = (short)htons(holder->packet.mouseMoveRel.deltaY);
+
+        totalDeltaX += (short)htons(newHolder->packet.mouseMoveRel.deltaX);
+        totalDeltaY += (short)htons(newHolder->packet.mouseMoveRel.deltaY);
+
+        // Check for overflow
+        if (totalDeltaX > INT16_MAX || totalDeltaX < INT16_MIN ||
+            totalDeltaY > INT16_MAX || totalDeltaY < INT16_MIN) {
+            // Total delta would overflow our 16-bit short
+            return 0;
+        }
 
-                // Peek at the next packet
-                if (LbqPeekQueueElement(&packetQueue, (void**)&controllerBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
+        // Update the original packet
+        holder->packet.mouseMoveRel.deltaX = htons((short)totalDeltaX);
+        holder->packet.mouseMoveRel.deltaY = htons((short)totalDeltaY);
 
-                // If it's not a controller packet, we're done
-                if (controllerBatchHolder->packet.multiController.header.packetType != htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
-                    break;
-                }
+        PltAtomicFetchAdd(&coalescedMouseMoveEvents, 1);
+        return 1;
+    }
+    // If it's an absolute mouse move packet, we should only send the latest
+    else if (holder->packet.header.packetType == htonl(PACKET_TYPE_ABS_MOUSE_MOVE)) {
+        uint64_t enqueueTimeUs = holder->enqueueTimeUs;
 
-                // Check if it's able to be batched
-                // NB: GFE does some discarding of gamepad packets received very soon after another.
-                // Thus, this batching is needed for correctness in some cases, as GFE will inexplicably
-                // drop *newer* packets in that scenario. The brokenness can be tested with consecutive
-                // calls to LiSendMultiControllerEvent() with different values for analog sticks (max -> zero).
-                newPkt = &controllerBatchHolder->packet.multiController;
-                if (newPkt->buttonFlags != origPkt->buttonFlags ||
-                    newPkt->controllerNumber != origPkt->controllerNumber ||
-                    newPkt->activeGamepadMask != origPkt->activeGamepadMask) {
-                    // Batching not allowed
-                    break;
-                }
+        *holder = *newHolder;
+        holder->enqueueTimeUs = enqueueTimeUs;
 
-                // Remove the batchable controller packet
-                if (LbqPollQueueElement(&packetQueue, (void**)&controllerBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
+        PltAtomicFetchAdd(&coalescedMousePositionEvents, 1);
+        return 1;
+    }
+    // Scroll deltas can be added together
+    else if (holder->packet.header.packetType == htonl(PACKET_TYPE_SCROLL)) {
+        int totalScroll = (short)htons(holder->packet.scroll.scrollAmt1);
 
-                // Update the original packet
-                origPkt->leftTrigger = newPkt->leftTrigger;
-                origPkt->rightTrigger = newPkt->rightTrigger;
-                origPkt->leftStickX = newPkt->leftStickX;
-                origPkt->leftStickY = newPkt->leftStickY;
-                origPkt->rightStickX = newPkt->rightStickX;
-                origPkt->rightStickY = newPkt->rightStickY;
+        totalScroll += (short)htons(newHolder->packet.scroll.scrollAmt1);
+        if (totalScroll > INT16_MAX || totalScroll < INT16_MIN) {
+            // Total scroll would overflow our 16-bit short
+            return 0;
+        }
 
-                // Free the batched packet holder
-                free(controllerBatchHolder);
-            }
+        holder->packet.scroll.scrollAmt1 = htons((short)totalScroll);
+        holder->packet.scroll.scrollAmt2 = holder->packet.scroll.scrollAmt1;
+
+        PltAtomicFetchAdd(&coalescedScrollEvents, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Queues a packet built by a LiSend*Event() function. Updates are merged into
+// the last packet queued for the same device if the send thread hasn't taken
+// it yet, even if packets for other devices were queued after it. Packets
+// that can't be merged, like buttons and keys, keep their order.
+static int queueInputPacket(PPACKET_HOLDER holder) {
+    int device = getCoalescingDevice(holder);
+    unsigned int position;
+    int err;
+
+    holder->enqueueTimeUs = PltGetMicroseconds();
+
+    if (device != COALESCE_DEVICE_NONE) {
+        unsigned int lastPosition = PltAtomicLoad(&lastQueuedPosition[device]);
+
+        if (lastPosition != 0 &&
+            MpscCoalesceItem(&packetQueue, lastPosition - 1, holder, coalesceInputPackets)) {
+            PltAtomicFetchAdd(&queuedEvents, 1);
+            return LBQ_SUCCESS;
         }
-        // If it's a relative mouse move packet, we can also do batching
-        else if (holder->packet.mouseMoveRel.header.packetType == htonl(PACKET_TYPE_REL_MOUSE_MOVE)) {
-            PPACKET_HOLDER mouseBatchHolder;
-            int totalDeltaX = (short)htons(holder->packet.mouseMoveRel.deltaX);
-            int totalDeltaY = (short)htons(holder->packet.mouseMoveRel.deltaY);
-
-            for (;;) {
-                int partialDeltaX;
-                int partialDeltaY;
-
-                // Peek at the next packet
-                if (LbqPeekQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
+    }
 
-                // If it's not a mouse move packet, we're done
-                if (mouseBatchHolder->packet.mouseMoveRel.header.packetType != htonl(PACKET_TYPE_REL_MOUSE_MOVE)) {
-                    break;
-                }
+    err = MpscOfferItem(&packetQueue, holder, &position);
+    if (err == LBQ_SUCCESS) {
+        PltAtomicFetchAdd(&queuedEvents, 1);
 
-                partialDeltaX = (short)htons(mouseBatchHolder->packet.mouseMoveRel.deltaX);
-                partialDeltaY = (short)htons(mouseBatchHolder->packet.mouseMoveRel.deltaY);
+        if (device != COALESCE_DEVICE_NONE) {
+            // Later updates for this device can be merged into this packet,
+            // but not into any packet queued before it
+            PltAtomicStore(&lastQueuedPosition[device], position + 1);
+        }
+        else if (holder->packet.header.packetType == htonl(PACKET_TYPE_KEYBOARD)) {
+            // Mouse input must not be moved ahead of key presses
+            PltAtomicStore(&lastQueuedPosition[COALESCE_DEVICE_MOUSE], 0);
+        }
+    }
+    else if (err == LBQ_BOUND_EXCEEDED) {
+        PltAtomicFetchAdd(&droppedEvents, 1);
+    }
 
-                // Check for overflow
-                if (partialDeltaX + totalDeltaX > INT16_MAX ||
-                    partialDeltaX + totalDeltaX < INT16_MIN ||
-                    partialDeltaY + totalDeltaY > INT16_MAX ||
-                    partialDeltaY + totalDeltaY < INT16_MIN) {
-                    // Total delta would overflow our 16-bit short
-                    break;
-                }
+    return err;
+}
 
-                // Remove the batchable mouse move packet
-                if (LbqPollQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
+// Returns whether this packet is a discrete event, like a key or button
+// press, rather than a continuous update that may be held back. Discrete
+// events are sent immediately to avoid adding latency to them.
+static int isDiscreteEvent(PPACKET_HOLDER holder) {
+    int device = getCoalescingDevice(holder);
 
-                totalDeltaX += partialDeltaX;
-                totalDeltaY += partialDeltaY;
+    if (device == COALESCE_DEVICE_NONE) {
+        return 1;
+    }
 
-                // Free the batched packet holder
-                free(mouseBatchHolder);
-            }
+    switch (ntohl(holder->packet.header.packetType)) {
+    case PACKET_TYPE_MOUSE_BUTTON:
+        return 1;
+    case PACKET_TYPE_CONTROLLER:
+        return holder->packet.controller.buttonFlags != lastSentButtonFlags[device];
+    case PACKET_TYPE_MULTI_CONTROLLER:
+        return holder->packet.multiController.buttonFlags != lastSentButtonFlags[device];
+    default:
+        return 0;
+    }
+}
+
+// Returns the number of milliseconds until this packet may be sent without
+// exceeding one packet per coalescing window for its device
+static int getCoalescingDelayMs(PPACKET_HOLDER holder, uint64_t now) {
+    int device;
+    uint64_t elapsedMs;
+
+    if (StreamConfig.inputCoalescingWindowMs <= 0 || isDiscreteEvent(holder)) {
+        return 0;
+    }
+
+    device = getCoalescingDevice(holder);
+    if (lastSendTimeMs[device] == 0) {
+        return 0;
+    }
+
+    elapsedMs = now - lastSendTimeMs[device];
+    if (elapsedMs >= (uint64_t)StreamConfig.inputCoalescingWindowMs) {
+        return 0;
+    }
+
+    return StreamConfig.inputCoalescingWindowMs - (int)elapsedMs;
+}
+
+// Remembers when a packet was sent for its device's coalescing window
+static void recordCoalescingWindow(PPACKET_HOLDER holder, uint64_t now) {
+    int device = getCoalescingDevice(holder);
+
+    if (device == COALESCE_DEVICE_NONE) {
+        return;
+    }
+
+    lastSendTimeMs[device] = now;
+    if (holder->packet.header.packetType == htonl(PACKET_TYPE_CONTROLLER)) {
+        lastSentButtonFlags[device] = holder->packet.controller.buttonFlags;
+    }
+    else if (holder->packet.header.packetType == htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
+        lastSentButtonFlags[device] = holder->packet.multiController.buttonFlags;
+    }
+}
+
+// Records when a packet was taken from the queue
+static void recordDequeuedPacket(PPACKET_HOLDER holder) {
+    unsigned int queueDepth = (unsigned int)MpscGetItemCount(&packetQueue) + 1;
+    unsigned int queueTimeUs = (unsigned int)(PltGetMicroseconds() - holder->enqueueTimeUs);
 
-            // Update the original packet
-            holder->packet.mouseMoveRel.deltaX = htons((short)totalDeltaX);
-            holder->packet.mouseMoveRel.deltaY = htons((short)totalDeltaY);
+    PltLockMutex(&sendStatsMutex);
+    if (queueDepth > sendStats.maxQueueDepth) {
+        sendStats.maxQueueDepth = queueDepth;
+    }
+    if (queueTimeUs > sendStats.maxQueueTimeUs) {
+        sendStats.maxQueueTimeUs = queueTimeUs;
+    }
+    totalQueueTimeUs += queueTimeUs;
+    PltUnlockMutex(&sendStatsMutex);
+}
+
+// Records a batch of packets that was written to the socket or flushed by
+// ENet. This is called by the control stream thread on Gen 5+ servers.
+void recordSentInputPackets(uint64_t* enqueueTimesUs, int count) {
+    uint64_t now = PltGetMicroseconds();
+    int i;
+
+    PltLockMutex(&sendStatsMutex);
+    for (i = 0; i < count; i++) {
+        unsigned int sendTimeUs = (unsigned int)(now - enqueueTimesUs[i]);
+
+        if (sendTimeUs > sendStats.maxSendTimeUs) {
+            sendStats.maxSendTimeUs = sendTimeUs;
         }
-        // If it's an absolute mouse move packet, we should only send the latest
-        else if (holder->packet.mouseMoveAbs.header.packetType == htonl(PACKET_TYPE_ABS_MOUSE_MOVE)) {
-            for (;;) {
-                PPACKET_HOLDER mouseBatchHolder;
-
-                // Peek at the next packet
-                if (LbqPeekQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
+        totalSendTimeUs += sendTimeUs;
+    }
 
-                // If it's not a mouse position packet, we're done
-                if (mouseBatchHolder->packet.mouseMoveAbs.header.packetType != htonl(PACKET_TYPE_ABS_MOUSE_MOVE)) {
-                    break;
-                }
+    sendStats.sentPackets += count;
+    sendStats.sentBatches++;
+    PltUnlockMutex(&sendStatsMutex);
+}
 
-                // Remove the mouse position packet
-                if (LbqPollQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
+void LiGetInputStats(PINPUT_STATS stats) {
+    PltLockMutex(&sendStatsMutex);
+    *stats = sendStats;
+    if (stats->sentPackets != 0) {
+        stats->averageQueueTimeUs = (unsigned int)(totalQueueTimeUs / stats->sentPackets);
+        stats->averageSendTimeUs = (unsigned int)(totalSendTimeUs / stats->sentPackets);
+    }
+    PltUnlockMutex(&sendStatsMutex);
+
+    stats->queuedEvents = (unsigned int)PltAtomicLoad(&queuedEvents);
+    stats->coalescedMouseMoveEvents = (unsigned int)PltAtomicLoad(&coalescedMouseMoveEvents);
+    stats->coalescedMousePositionEvents = (unsigned int)PltAtomicLoad(&coalescedMousePositionEvents);
+    stats->coalescedControllerEvents = (unsigned int)PltAtomicLoad(&coalescedControllerEvents);
+    stats->coalescedScrollEvents = (unsigned int)PltAtomicLoad(&coalescedScrollEvents);
+    stats->droppedEvents = (unsigned int)PltAtomicLoad(&droppedEvents);
+}
 
-                // Replace the current packet with the new one
-                free(holder);
-                holder = mouseBatchHolder;
-            }
+// Returns whether a discrete event is queued behind the head of the queue.
+// Otherwise, waitOffset receives the offset of the next item to be queued.
+static int isDiscreteEventQueued(int* waitOffset) {
+    PACKET_HOLDER holder;
+    int offset;
+
+    for (offset = 1; MpscPeekItemAt(&packetQueue, offset, &holder) == LBQ_SUCCESS; offset++) {
+        if (isDiscreteEvent(&holder)) {
+            return 1;
+        }
+    }
+
+    *waitOffset = offset;
+    return 0;
+}
+
+// Takes the next packet unless it's being held back by its coalescing window.
+// If it is held back, delayMs receives the time left in the window and
+// waitOffset receives the offset of the next item to be queued.
+static int pollSendablePacket(PPACKET_HOLDER holder, int* delayMs, int* waitOffset) {
+    *delayMs = 0;
+    *waitOffset = 0;
+
+    if (StreamConfig.inputCoalescingWindowMs > 0) {
+        if (MpscPeekItem(&packetQueue, holder) != LBQ_SUCCESS) {
+            return LBQ_NO_ELEMENT;
         }
 
-        // Encrypt the message into the output buffer while leaving room for the length
-        encryptedSize = sizeof(encryptedBuffer) - 4;
-        err = encryptData((const unsigned char*)&holder->packet, holder->packetLength,
-            (unsigned char*)&encryptedBuffer[4], &encryptedSize);
-        free(holder);
-        if (err != 0) {
-            Limelog("Input: Encryption failed: %d\n", (int)err);
-            ListenerCallbacks.connectionTerminated(err);
+        // More updates can be merged into the packet while we wait, unless
+        // a discrete event is waiting behind it. In that case the packet
+        // is sent now, so the event isn't delayed and stays in order.
+        // It's also sent if the queue is full, since no event can be
+        // queued behind it to wake us up.
+        *delayMs = getCoalescingDelayMs(holder, PltGetMillis());
+        if (*delayMs > 0 && !isDiscreteEventQueued(waitOffset) &&
+                *waitOffset < INPUT_QUEUE_SIZE) {
+            return LBQ_NO_ELEMENT;
+        }
+    }
+
+    return MpscPollItem(&packetQueue, holder);
+}
+
+// Input thread proc
+static void inputSendThreadProc(void* context) {
+    SOCK_RET err;
+    PACKET_HOLDER holder;
+    char batchBuffer[MAX_INPUT_BATCH_PACKETS * MAX_INPUT_PACKET_SIZE];
+    uint64_t enqueueTimesUs[MAX_INPUT_BATCH_PACKETS];
+    int batchSize;
+    int batchCount;
+    int moreData;
+    int delayMs;
+    int waitOffset;
+
+    while (!PltIsThreadInterrupted(&inputSendThread)) {
+        // Packets are coalesced as they're queued
+        err = MpscWaitForData(&packetQueue);
+        if (err != LBQ_SUCCESS) {
             return;
         }
 
-        // Prepend the length to the message
-        encryptedLengthPrefix = htonl((unsigned long)encryptedSize);
-        memcpy(&encryptedBuffer[0], &encryptedLengthPrefix, 4);
+        if (pollSendablePacket(&holder, &delayMs, &waitOffset) != LBQ_SUCCESS) {
+            // Wait out the coalescing window, but wake up if another event
+            // is queued in case it must be sent right away
+            if (MpscWaitForItemAt(&packetQueue, waitOffset, delayMs) == LBQ_INTERRUPTED) {
+                return;
+            }
+            continue;
+        }
+
+        // Send any other packets that are already queued along with this one
+        batchSize = 0;
+        batchCount = 0;
+        do {
+            char* encryptedBuffer = &batchBuffer[batchSize];
+            int encryptedSize;
+            int encryptedLengthPrefix;
+
+            enqueueTimesUs[batchCount] = holder.enqueueTimeUs;
+            recordDequeuedPacket(&holder);
+            recordCoalescingWindow(&holder, PltGetMillis());
+
+            // Encrypt the message into the output buffer while leaving room for the length
+            encryptedSize = MAX_INPUT_PACKET_SIZE - 4;
+            err = encryptData((const unsigned char*)&holder.packet, holder.packetLength,
+                (unsigned char*)&encryptedBuffer[4], &encryptedSize);
+            if (err != 0) {
+                Limelog("Input: Encryption failed: %d\n", (int)err);
+                ListenerCallbacks.connectionTerminated(err);
+                return;
+            }
+
+            // Prepend the length to the message
+            encryptedLengthPrefix = htonl((unsigned long)encryptedSize);
+            memcpy(&encryptedBuffer[0], &encryptedLengthPrefix, 4);
+            batchCount++;
+
+            moreData = batchCount < MAX_INPUT_BATCH_PACKETS &&
+                pollSendablePacket(&holder, &delayMs, &waitOffset) == LBQ_SUCCESS;
+
+            if (AppVersionQuad[0] < 5) {
+                // The batch is sent with a single write below
+                batchSize += encryptedSize + sizeof(encryptedLengthPrefix);
+            }
+            else {
+                // For reasons that I can't understand, NVIDIA decides to use the last 16
+                // bytes of ciphertext in the most recent game controller packet as the IV for
+                // future encryption. I think it may be a buffer overrun on their end but we'll have
+                // to mimic it to work correctly.
+                if (AppVersionQuad[0] >= 7 && encryptedSize >= 16 + sizeof(currentAesIv)) {
+                    memcpy(currentAesIv,
+                           &encryptedBuffer[4 + encryptedSize - sizeof(currentAesIv)],
+                           sizeof(currentAesIv));
+                }
+
+                // ENet holds each packet until the last one in the batch is flushed
+                err = (SOCK_RET)sendInputPacketOnControlStream((unsigned char*) encryptedBuffer,
+                    (int) (encryptedSize + sizeof(encryptedLengthPrefix)), moreData,
+                    enqueueTimesUs[batchCount - 1]);
+                if (err < 0) {
+                    Limelog("Input: sendInputPacketOnControlStream() failed: %d\n", (int) err);
+                    ListenerCallbacks.connectionTerminated(err);
+                    return;
+                }
+            }
+        } while (moreData);
 
         if (AppVersionQuad[0] < 5) {
-            // Send the encrypted payload
-            err = send(inputSock, (const char*) encryptedBuffer,
-                (int) (encryptedSize + sizeof(encryptedLengthPrefix)), 0);
+            // Send the encrypted payloads
+            err = send(inputSock, (const char*) batchBuffer, batchSize, 0);
             if (err <= 0) {
                 Limelog("Input: send() failed: %d\n", (int) LastSocketError());
                 ListenerCallbacks.connectionTerminated(LastSocketFail());
                 return;
             }
-        }
-        else {
-            // For reasons that I can't understand, NVIDIA decides to use the last 16
-            // bytes of ciphertext in the most recent game controller packet as the IV for
-            // future encryption. I think it may be a buffer overrun on their end but we'll have
-            // to mimic it to work correctly.
-            if (AppVersionQuad[0] >= 7 && encryptedSize >= 16 + sizeof(currentAesIv)) {
-                memcpy(currentAesIv,
-                       &encryptedBuffer[4 + encryptedSize - sizeof(currentAesIv)],
-                       sizeof(currentAesIv));
-            }
-            
-            err = (SOCK_RET)sendInputPacketOnControlStream((unsigned char*) encryptedBuffer,
-                (int) (encryptedSize + sizeof(encryptedLengthPrefix)));
-            if (err < 0) {
-                Limelog("Input: sendInputPacketOnControlStream() failed: %d\n", (int) err);
-                ListenerCallbacks.connectionTerminated(err);
-                return;
-            }
+
+            recordSentInputPackets(enqueueTimesUs, batchCount);
         }
     }
 }
 
 // This function tells GFE that we support haptics and it should send rumble events to us
 static int sendEnableHaptics(void) {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     // Avoid sending this on earlier server versions, since they may terminate
     // the connection upon receiving an unexpected packet.
@@ -378,22 +666,12 @@ static int sendEnableHaptics(void) {
         return 0;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
-    holder->packetLength = sizeof(NV_HAPTICS_PACKET);
-    holder->packet.haptics.header.packetType = htonl(PACKET_TYPE_HAPTICS);
-    holder->packet.haptics.magicA = H_MAGIC_A;
-    holder->packet.haptics.magicB = H_MAGIC_B;
+    holder.packetLength = sizeof(NV_HAPTICS_PACKET);
+    holder.packet.haptics.header.packetType = htonl(PACKET_TYPE_HAPTICS);
+    holder.packet.haptics.magicA = H_MAGIC_A;
+    holder.packet.haptics.magicB = H_MAGIC_B;
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queueInputPacket(&holder);
 }
 
 // Begin the input stream
@@ -435,7 +713,7 @@ int stopInputStream(void) {
     initialized = 0;
 
     // Signal the input send thread
-    LbqSignalQueueShutdown(&packetQueue);
+    MpscSignalQueueShutdown(&packetQueue);
     PltInterruptThread(&inputSendThread);
 
     if (inputSock != INVALID_SOCKET) {
@@ -455,8 +733,7 @@ int stopInputStream(void) {
 
 // Send a mouse move event to the streaming machine
 int LiSendMouseMoveEvent(short deltaX, short deltaY) {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     if (!initialized) {
         return -2;
@@ -466,110 +743,72 @@ int LiSendMouseMoveEvent(short deltaX, short deltaY) {
         return 0;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
-    holder->packetLength = sizeof(NV_REL_MOUSE_MOVE_PACKET);
-    holder->packet.mouseMoveRel.header.packetType = htonl(PACKET_TYPE_REL_MOUSE_MOVE);
-    holder->packet.mouseMoveRel.magic = MOUSE_MOVE_REL_MAGIC;
+    holder.packetLength = sizeof(NV_REL_MOUSE_MOVE_PACKET);
+    holder.packet.mouseMoveRel.header.packetType = htonl(PACKET_TYPE_REL_MOUSE_MOVE);
+    holder.packet.mouseMoveRel.magic = MOUSE_MOVE_REL_MAGIC;
     // On Gen 5 servers, the header code is incremented by one
     if (AppVersionQuad[0] >= 5) {
-        holder->packet.mouseMoveRel.magic++;
+        holder.packet.mouseMoveRel.magic++;
     }
-    holder->packet.mouseMoveRel.deltaX = htons(deltaX);
-    holder->packet.mouseMoveRel.deltaY = htons(deltaY);
+    holder.packet.mouseMoveRel.deltaX = htons(deltaX);
+    holder.packet.mouseMoveRel.deltaY = htons(deltaY);
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queueInputPacket(&holder);
 }
 
 // Send a mouse position update to the streaming machine
 int LiSendMousePositionEvent(short x, short y, short referenceWidth, short referenceHeight) {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
-    holder->packetLength = sizeof(NV_ABS_MOUSE_MOVE_PACKET);
-    holder->packet.mouseMoveAbs.header.packetType = htonl(PACKET_TYPE_ABS_MOUSE_MOVE);
-    holder->packet.mouseMoveAbs.magic = MOUSE_MOVE_ABS_MAGIC;
-    holder->packet.mouseMoveAbs.x = htons(x);
-    holder->packet.mouseMoveAbs.y = htons(y);
-    holder->packet.mouseMoveAbs.unused = 0;
+    holder.packetLength = sizeof(NV_ABS_MOUSE_MOVE_PACKET);
+    holder.packet.mouseMoveAbs.header.packetType = htonl(PACKET_TYPE_ABS_MOUSE_MOVE);
+    holder.packet.mouseMoveAbs.magic = MOUSE_MOVE_ABS_MAGIC;
+    holder.packet.mouseMoveAbs.x = htons(x);
+    holder.packet.mouseMoveAbs.y = htons(y);
+    holder.packet.mouseMoveAbs.unused = 0;
 
     // There appears to be a rounding error in GFE's scaling calculation which prevents
     // the cursor from reaching the far edge of the screen when streaming at smaller
     // resolutions with a higher desktop resolution (like streaming 720p with a desktop
     // resolution of 1080p, or streaming 720p/1080p with a desktop resolution of 4K).
     // Subtracting one from the reference dimensions seems to work around this issue.
-    holder->packet.mouseMoveAbs.width = htons(referenceWidth - 1);
-    holder->packet.mouseMoveAbs.height = htons(referenceHeight - 1);
+    holder.packet.mouseMoveAbs.width = htons(referenceWidth - 1);
+    holder.packet.mouseMoveAbs.height = htons(referenceHeight - 1);
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queueInputPacket(&holder);
 }
 
 // Send a mouse button event to the streaming machine
 int LiSendMouseButtonEvent(char action, int button) {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
-    holder->packetLength = sizeof(NV_MOUSE_BUTTON_PACKET);
-    holder->packet.mouseButton.header.packetType = htonl(PACKET_TYPE_MOUSE_BUTTON);
-    holder->packet.mouseButton.action = action;
+    holder.packetLength = sizeof(NV_MOUSE_BUTTON_PACKET);
+    holder.packet.mouseButton.header.packetType = htonl(PACKET_TYPE_MOUSE_BUTTON);
+    holder.packet.mouseButton.action = action;
     if (AppVersionQuad[0] >= 5) {
-        holder->packet.mouseButton.action++;
+        holder.packet.mouseButton.action++;
     }
-    holder->packet.mouseButton.button = htonl(button);
+    holder.packet.mouseButton.button = htonl(button);
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queueInputPacket(&holder);
 }
 
 // Send a key press event to the streaming machine
 int LiSendKeyboardEvent(short keyCode, char keyAction, char modifiers) {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
     // For proper behavior, the MODIFIER flag must not be set on the modifier key down event itself
     // for the extended modifiers on the right side of the keyboard. If the MODIFIER flag is set,
     // GFE will synthesize an errant key down event for the non-extended key, causing that key to be
@@ -612,85 +851,69 @@ int LiSendKeyboardEvent(short keyCode, char keyAction, char modifiers) {
         break;
     }
 
-    holder->packetLength = sizeof(NV_KEYBOARD_PACKET);
-    holder->packet.keyboard.header.packetType = htonl(PACKET_TYPE_KEYBOARD);
-    holder->packet.keyboard.keyAction = keyAction;
-    holder->packet.keyboard.zero1 = 0;
-    holder->packet.keyboard.keyCode = keyCode;
-    holder->packet.keyboard.modifiers = modifiers;
-    holder->packet.keyboard.zero2 = 0;
+    holder.packetLength = sizeof(NV_KEYBOARD_PACKET);
+    holder.packet.keyboard.header.packetType = htonl(PACKET_TYPE_KEYBOARD);
+    holder.packet.keyboard.keyAction = keyAction;
+    holder.packet.keyboard.zero1 = 0;
+    holder.packet.keyboard.keyCode = keyCode;
+    holder.packet.keyboard.modifiers = modifiers;
+    holder.packet.keyboard.zero2 = 0;
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queueInputPacket(&holder);
 }
 
 static int sendControllerEventInternal(short controllerNumber, short activeGamepadMask,
     short buttonFlags, unsigned char leftTrigger, unsigned char rightTrigger,
     short leftStickX, short leftStickY, short rightStickX, short rightStickY)
 {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
     if (AppVersionQuad[0] == 3) {
         // Generation 3 servers don't support multiple controllers so we send
         // the legacy packet
-        holder->packetLength = sizeof(NV_CONTROLLER_PACKET);
-        holder->packet.controller.header.packetType = htonl(PACKET_TYPE_CONTROLLER);
-        holder->packet.controller.headerA = C_HEADER_A;
-        holder->packet.controller.headerB = C_HEADER_B;
-        holder->packet.controller.buttonFlags = buttonFlags;
-        holder->packet.controller.leftTrigger = leftTrigger;
-        holder->packet.controller.rightTrigger = rightTrigger;
-        holder->packet.controller.leftStickX = leftStickX;
-        holder->packet.controller.leftStickY = leftStickY;
-        holder->packet.controller.rightStickX = rightStickX;
-        holder->packet.controller.rightStickY = rightStickY;
-        holder->packet.controller.tailA = C_TAIL_A;
-        holder->packet.controller.tailB = C_TAIL_B;
+        holder.packetLength = sizeof(NV_CONTROLLER_PACKET);
+        holder.packet.controller.header.packetType = htonl(PACKET_TYPE_CONTROLLER);
+        holder.packet.controller.headerA = C_HEADER_A;
+        holder.packet.controller.headerB = C_HEADER_B;
+        holder.packet.controller.buttonFlags = buttonFlags;
+        holder.packet.controller.leftTrigger = leftTrigger;
+        holder.packet.controller.rightTrigger = rightTrigger;
+        holder.packet.controller.leftStickX = leftStickX;
+        holder.packet.controller.leftStickY = leftStickY;
+        holder.packet.controller.rightStickX = rightStickX;
+        holder.packet.controller.rightStickY = rightStickY;
+        holder.packet.controller.tailA = C_TAIL_A;
+        holder.packet.controller.tailB = C_TAIL_B;
     }
     else {
         // Generation 4+ servers support passing the controller number
-        holder->packetLength = sizeof(NV_MULTI_CONTROLLER_PACKET);
-        holder->packet.multiController.header.packetType = htonl(PACKET_TYPE_MULTI_CONTROLLER);
-        holder->packet.multiController.headerA = MC_HEADER_A;
+        holder.packetLength = sizeof(NV_MULTI_CONTROLLER_PACKET);
+        holder.packet.multiController.header.packetType = htonl(PACKET_TYPE_MULTI_CONTROLLER);
+        holder.packet.multiController.headerA = MC_HEADER_A;
         // On Gen 5 servers, the header code is decremented by one
         if (AppVersionQuad[0] >= 5) {
-            holder->packet.multiController.headerA--;
+            holder.packet.multiController.headerA--;
         }
-        holder->packet.multiController.headerB = MC_HEADER_B;
-        holder->packet.multiController.controllerNumber = controllerNumber;
-        holder->packet.multiController.activeGamepadMask = activeGamepadMask;
-        holder->packet.multiController.midB = MC_MID_B;
-        holder->packet.multiController.buttonFlags = buttonFlags;
-        holder->packet.multiController.leftTrigger = leftTrigger;
-        holder->packet.multiController.rightTrigger = rightTrigger;
-        holder->packet.multiController.leftStickX = leftStickX;
-        holder->packet.multiController.leftStickY = leftStickY;
-        holder->packet.multiController.rightStickX = rightStickX;
-        holder->packet.multiController.rightStickY = rightStickY;
-        holder->packet.multiController.tailA = MC_TAIL_A;
-        holder->packet.multiController.tailB = MC_TAIL_B;
-    }
-
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+        holder.packet.multiController.headerB = MC_HEADER_B;
+        holder.packet.multiController.controllerNumber = controllerNumber;
+        holder.packet.multiController.activeGamepadMask = activeGamepadMask;
+        holder.packet.multiController.midB = MC_MID_B;
+        holder.packet.multiController.buttonFlags = buttonFlags;
+        holder.packet.multiController.leftTrigger = leftTrigger;
+        holder.packet.multiController.rightTrigger = rightTrigger;
+        holder.packet.multiController.leftStickX = leftStickX;
+        holder.packet.multiController.leftStickY = leftStickY;
+        holder.packet.multiController.rightStickX = rightStickX;
+        holder.packet.multiController.rightStickY = rightStickY;
+        holder.packet.multiController.tailA = MC_TAIL_A;
+        holder.packet.multiController.tailB = MC_TAIL_B;
+    }
+
+    return queueInputPacket(&holder);
 }
 
 // Send a controller event to the streaming machine
@@ -713,8 +936,7 @@ int LiSendMultiControllerEvent(short controllerNumber, short activeGamepadMask,
 
 // Send a high resolution scroll event to the streaming machine
 int LiSendHighResScrollEvent(short scrollAmount) {
-    PPACKET_HOLDER holder;
-    int err;
+    PACKET_HOLDER holder;
 
     if (!initialized) {
         return -2;
@@ -724,30 +946,20 @@ int LiSendHighResScrollEvent(short scrollAmount) {
         return 0;
     }
 
-    holder = malloc(sizeof(*holder));
-    if (holder == NULL) {
-        return -1;
-    }
-
-    holder->packetLength = sizeof(NV_SCROLL_PACKET);
-    holder->packet.scroll.header.packetType = htonl(PACKET_TYPE_SCROLL);
-    holder->packet.scroll.magicA = MAGIC_A;
+    holder.packetLength = sizeof(NV_SCROLL_PACKET);
+    holder.packet.scroll.header.packetType = htonl(PACKET_TYPE_SCROLL);
+    holder.packet.scroll.magicA = MAGIC_A;
     // On Gen 5 servers, the header code is incremented by one
     if (AppVersionQuad[0] >= 5) {
-        holder->packet.scroll.magicA++;
+        holder.packet.scroll.magicA++;
     }
-    holder->packet.scroll.zero1 = 0;
-    holder->packet.scroll.zero2 = 0;
-    holder->packet.scroll.scrollAmt1 = htons(scrollAmount);
-    holder->packet.scroll.scrollAmt2 = holder->packet.scroll.scrollAmt1;
-    holder->packet.scroll.zero3 = 0;
+    holder.packet.scroll.zero1 = 0;
+    holder.packet.scroll.zero2 = 0;
+    holder.packet.scroll.scrollAmt1 = htons(scrollAmount);
+    holder.packet.scroll.scrollAmt2 = holder.packet.scroll.scrollAmt1;
+    holder.packet.scroll.zero3 = 0;
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queueInputPacket(&holder);
 }
 
 // Send a scroll event to the streaming machine
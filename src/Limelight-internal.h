@@ -68,10 +68,20 @@ int stopControlStream(void);
 void destroyControlStream(void);
 void requestIdrOnDemand(void);
 void connectionDetectedFrameLoss(int startFrame, int endFrame);
-void connectionReceivedCompleteFrame(int frameIndex);
+void connectionReceivedCompleteFrame(int frameIndex, int isIdrFrame, uint64_t receiveTimeMs);
 void connectionSawFrame(int frameIndex);
-void connectionLostPackets(int lastReceivedPacket, int nextReceivedPacket);
-int sendInputPacketOnControlStream(unsigned char* data, int length);
+void connectionLostPackets(int lostPackets);
+void connectionRecordRtspRequestTime(const char* command, unsigned int durationMs);
+void connectionReceivedFirstVideoPacket(void);
+void connectionReceivedFirstFrame(void);
+
+void initializeConnectionQuality(void);
+void destroyConnectionQuality(void);
+void connectionQualityAddFrame(int frameIndex, unsigned int rtpTimestamp, uint64_t receiveTimeUs,
+                               int dataPackets, int parityPackets, int missingDataPackets,
+                               int skippedPackets, int completed);
+int sendInputPacketOnControlStream(unsigned char* data, int length, int moreData, uint64_t enqueueTimeUs);
+void recordSentInputPackets(uint64_t* enqueueTimesUs, int count);
 
 int performRtspHandshake(void);
 
@@ -87,7 +97,7 @@ int startVideoStream(void* rendererContext, int drFlags);
 void submitFrame(PQUEUED_DECODE_UNIT qdu);
 void stopVideoStream(void);
 
-void initializeAudioStream(void);
+int initializeAudioStream(void);
 void destroyAudioStream(void);
 int startAudioStream(void* audioContext, int arFlags);
 void stopAudioStream(void);
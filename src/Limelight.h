@@ -91,6 +91,26 @@ typedef struct _STREAM_CONFIGURATION {
     // in /launch and /resume requests.
     char remoteInputAesKey[16];
     char remoteInputAesIv[16];
+
+    // If specified, the audio and video RTP sockets are serviced by a single
+    // shared thread which also sends the UDP pings for both streams. This
+    // replaces the dedicated receive and ping threads for each stream,
+    // which reduces the number of threads and idle wakeups per connection.
+    int useSharedReceiveThread;
+
+    // If non-zero, continuous input updates (mouse motion, scrolling and
+    // controller analog state) for each device are sent at most once per
+    // this many milliseconds. Updates made in the meantime are merged into
+    // the pending packet. This bounds the packet rate for high-rate devices
+    // at the cost of up to this much added latency for those updates.
+    int inputCoalescingWindowMs;
+
+    // If not NULL, LiStartConnection() probes the network path with
+    // LiProbeConnection() against this echo server before the RTSP
+    // handshake. The bitrate and packetSize are lowered to the recommended
+    // values if they are higher. A failed probe is logged and ignored.
+    const char* probeServer;
+    unsigned short probePort;
 } STREAM_CONFIGURATION, *PSTREAM_CONFIGURATION;
 
 // Use this function to zero the stream configuration when allocated on the stack or heap
@@ -541,6 +561,166 @@ int LiGetPendingAudioFrames(void);
 // negotiated audio frame duration.
 int LiGetPendingAudioDuration(void);
 
+// Estimates how much faster the host's audio clock runs than the local clock,
+// in parts per million. A positive value means the host is producing audio
+// faster than real time here, so the renderer would need to play back that
+// much faster to keep its buffer from growing. Returns 0 on success or -1 if
+// not enough audio has been received yet (about 16 seconds).
+int LiGetEstimatedAudioClockDrift(int* driftPpm);
+
+typedef struct _CONNECTION_QUALITY {
+    // Smoothed share of video packets lost after FEC recovery, in tenths
+    // of a percent
+    unsigned int packetLossPerMille;
+
+    // Smoothed share of video frames that were lost or couldn't be
+    // recovered, in tenths of a percent
+    unsigned int frameLossPerMille;
+
+    // Smoothed share of each frame's FEC parity that was needed to recover
+    // lost packets, in tenths of a percent. Values approaching 1000 mean
+    // the loss rate is close to what FEC can repair.
+    unsigned int fecUsagePerMille;
+
+    // Smoothed interarrival jitter of video frames in microseconds
+    unsigned int jitterUs;
+
+    // One-way delay of the last frame above the lowest recently seen delay,
+    // in microseconds. This grows as queues build up along the path.
+    unsigned int queuingDelayUs;
+
+    // Smoothed rate of change of the one-way delay, in microseconds per
+    // second. A sustained positive value indicates congestion.
+    int delayTrendUsPerSec;
+} CONNECTION_QUALITY, *PCONNECTION_QUALITY;
+
+// Returns estimates of the current video network conditions. These follow
+// changes within a few hundred milliseconds, unlike the connectionStatusUpdate
+// callback. Returns 0 on success or -1 if no video has been received yet.
+int LiGetConnectionQuality(PCONNECTION_QUALITY quality);
+
+typedef struct _INPUT_STATS {
+    // Events accepted by LiSend*Event() functions, including coalesced events
+    unsigned int queuedEvents;
+
+    // Events that were merged into an event that was already queued
+    unsigned int coalescedMouseMoveEvents;
+    unsigned int coalescedMousePositionEvents;
+    unsigned int coalescedControllerEvents;
+    unsigned int coalescedScrollEvents;
+
+    // Events rejected with LBQ_BOUND_EXCEEDED because the queue was full
+    unsigned int droppedEvents;
+
+    // The most packets waiting in the queue at once
+    unsigned int maxQueueDepth;
+
+    // Packets sent to the host and the number of writes or ENet flushes used
+    unsigned int sentPackets;
+    unsigned int sentBatches;
+
+    // Time in microseconds from the LiSend*Event() call until the packet was
+    // taken from the queue. For coalesced packets, this is measured from the
+    // first event merged into the packet.
+    unsigned int averageQueueTimeUs;
+    unsigned int maxQueueTimeUs;
+
+    // Time in microseconds from the LiSend*Event() call until the packet was
+    // handed to the socket or flushed by ENet
+    unsigned int averageSendTimeUs;
+    unsigned int maxSendTimeUs;
+} INPUT_STATS, *PINPUT_STATS;
+
+// Returns statistics about the input sent during the current connection.
+// This can help attribute input lag to the library rather than the network
+// or the host.
+void LiGetInputStats(PINPUT_STATS stats);
+
+typedef struct _LOSS_RECOVERY_STATS {
+    // Reference frame invalidation and IDR frame requests sent to the host
+    unsigned int rfiRequests;
+    unsigned int idrRequests;
+
+    // Lost frame ranges that were merged into a request that hadn't been
+    // sent yet or were covered by an outstanding IDR frame request
+    unsigned int coalescedRfiRanges;
+
+    // IDR frame requests that weren't sent because one was already in flight
+    unsigned int suppressedIdrRequests;
+
+    // RFI requests that didn't lead to a complete frame in time and were
+    // replaced by an IDR frame request
+    unsigned int escalatedRfiRequests;
+
+    // Time in milliseconds from the first loss (or decoder IDR request)
+    // until a usable frame was received again
+    unsigned int recoveries;
+    unsigned int averageRecoveryTimeMs;
+    unsigned int maxRecoveryTimeMs;
+    unsigned int lastRecoveryTimeMs;
+} LOSS_RECOVERY_STATS, *PLOSS_RECOVERY_STATS;
+
+// Returns statistics about how the current connection recovered from lost
+// or undecodable video frames.
+void LiGetLossRecoveryStats(PLOSS_RECOVERY_STATS stats);
+
+typedef struct _CONTROL_LINK_STATS {
+    // Smoothed round trip time of the control stream and its variance, and
+    // the lowest round trip time seen, in milliseconds
+    unsigned int rttMs;
+    unsigned int rttVarianceMs;
+    unsigned int lowestRttMs;
+
+    // Reliable packets sent to the host and how many of those had to be
+    // retransmitted because they weren't acknowledged in time
+    unsigned int sentPackets;
+    unsigned int retransmittedPackets;
+
+    // ENet's packet loss estimate over its last measurement interval
+    // (10 seconds), in tenths of a percent
+    unsigned int packetLossPerMille;
+
+    // Share of unreliable traffic that ENet's throttle currently lets through.
+    // This drops below 100 when the round trip time rises above its average.
+    unsigned int packetThrottlePercent;
+} CONTROL_LINK_STATS, *PCONTROL_LINK_STATS;
+
+// Returns statistics for the control stream connection. Comparing the round
+// trip time with the video delay trend in LiGetConnectionQuality() helps to
+// tell network latency apart from latency added by the host's encoder.
+// Returns 0 on success or -1 if no statistics are available. Statistics are
+// only available for Gen 5+ servers, which use ENet for the control stream.
+int LiGetControlLinkStats(PCONTROL_LINK_STATS stats);
+
+typedef struct _STARTUP_REPORT {
+    // Time in milliseconds spent in each stage of LiStartConnection(),
+    // indexed by the STAGE_* values. Stages that didn't complete are 0.
+    unsigned int stageDurationMs[STAGE_MAX];
+
+    // Time spent on the connection probe, if probeServer was set
+    unsigned int probeMs;
+
+    // Time in milliseconds spent on each type of RTSP request during the
+    // RTSP handshake stage. Requests sent more than once are added together.
+    unsigned int rtspOptionsMs;
+    unsigned int rtspDescribeMs;
+    unsigned int rtspSetupMs;
+    unsigned int rtspAnnounceMs;
+    unsigned int rtspPlayMs;
+
+    // Time in milliseconds from the start of LiStartConnection() until the
+    // connectionStarted callback, the first video packet and the first
+    // complete video frame. These are 0 until the event happens.
+    unsigned int connectionStartedMs;
+    unsigned int firstVideoPacketMs;
+    unsigned int firstFrameMs;
+} STARTUP_REPORT, *PSTARTUP_REPORT;
+
+// Returns how long each part of the most recent LiStartConnection() call took.
+// This may be called during or after connection setup. The first video packet
+// and frame often arrive after LiStartConnection() returns.
+void LiGetStartupReport(PSTARTUP_REPORT report);
+
 // Port index flags for use with LiGetPortFromPortFlagIndex() and LiGetProtocolFromPortFlagIndex()
 #define ML_PORT_INDEX_TCP_47984 0
 #define ML_PORT_INDEX_TCP_47989 1
@@ -588,6 +768,31 @@ unsigned short LiGetPortFromPortFlagIndex(int portFlagIndex);
 #define ML_TEST_RESULT_INCONCLUSIVE 0xFFFFFFFF
 unsigned int LiTestClientConnectivity(const char* testServer, unsigned short referencePort, unsigned int testPortFlags);
 
+typedef struct _PROBE_RESULT {
+    // Round trip time and interarrival jitter measured without load
+    unsigned int rttMs;
+    unsigned int jitterUs;
+
+    // Highest rate in Kbps that the path sustained, and the packet loss seen
+    // at that rate in tenths of a percent
+    int throughputKbps;
+    unsigned int lossPerMille;
+
+    // Suggested values for the bitrate and packetSize fields of STREAM_CONFIGURATION
+    int recommendedBitrate;
+    int recommendedPacketSize;
+} PROBE_RESULT, *PPROBE_RESULT;
+
+// This function measures the throughput, loss and jitter of the network path to a server that
+// echoes each UDP datagram back to its sender on the given port. It first checks whether packets
+// of maxPacketSize get through, falling back to 1024 bytes if they don't. Then it sends 100 ms
+// bursts at doubling bitrates, starting at 2 Mbps, until maxBitrate (in Kbps) is reached or the
+// echoed packets show loss or fall behind. The probe takes a few seconds at most. Since traffic
+// crosses the path in both directions, the result is limited by the slower direction.
+//
+// Returns 0 on success and fills out the result, or a non-zero error code on failure.
+int LiProbeConnection(const char* probeServer, unsigned short probePort, int maxBitrate, int maxPacketSize, PPROBE_RESULT result);
+
 #ifdef __cplusplus
 }
 #endif
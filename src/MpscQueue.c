@@ -0,0 +1,297 @@
+#include "MpscQueue.h"
+#include "PlatformAtomics.h"
+
+// A bounded queue of fixed size items that any number of threads may offer
+// to without locking or allocating, and that a single consumer thread takes
+// from. This follows the usual sequence-numbered ring design. Each slot also
+// has a state so that a producer can merge a new item into a queued item as
+// long as the consumer hasn't started reading it.
+
+#define SLOT_FREE    0
+#define SLOT_WRITING 1
+#define SLOT_READY   2
+#define SLOT_READING 3
+
+#define SLOT_INDEX(queue, position) ((position) & ((queue)->slotCount - 1))
+#define SLOT_ITEM(queue, index) (&(queue)->items[(index) * (queue)->itemSize])
+
+// slotCount must be a power of 2
+int MpscInitializeQueue(PMPSC_QUEUE queue, int slotCount, int itemSize) {
+    int err;
+    int i;
+
+    LC_ASSERT(slotCount > 0 && (slotCount & (slotCount - 1)) == 0);
+
+    memset(queue, 0, sizeof(*queue));
+
+    queue->slots = (PMPSC_SLOT)malloc(sizeof(*queue->slots) * slotCount);
+    queue->items = (char*)malloc(itemSize * slotCount);
+    if (queue->slots == NULL || queue->items == NULL) {
+        free(queue->slots);
+        free(queue->items);
+        return -1;
+    }
+
+    for (i = 0; i < slotCount; i++) {
+        queue->slots[i].sequence = i;
+        queue->slots[i].state = SLOT_FREE;
+    }
+
+    queue->slotCount = slotCount;
+    queue->itemSize = itemSize;
+
+    err = PltCreateEvent(&queue->containsDataEvent);
+    if (err != 0) {
+        free(queue->slots);
+        free(queue->items);
+        return err;
+    }
+
+    return 0;
+}
+
+void MpscDestroyQueue(PMPSC_QUEUE queue) {
+    PltCloseEvent(&queue->containsDataEvent);
+    free(queue->slots);
+    free(queue->items);
+}
+
+void MpscSignalQueueShutdown(PMPSC_QUEUE queue) {
+    queue->shutdown = 1;
+    PltSetEvent(&queue->containsDataEvent);
+}
+
+// The count may be stale by the time it's returned
+int MpscGetItemCount(PMPSC_QUEUE queue) {
+    return (int)(PltAtomicLoad(&queue->tail) - PltAtomicLoad(&queue->head));
+}
+
+// Tries to merge the item into the queued item at the given position. This
+// fails if that item has been taken or is being read by the consumer.
+int MpscCoalesceItem(PMPSC_QUEUE queue, unsigned int position, const void* item, MpscCoalesceCallback coalesce) {
+    int index = SLOT_INDEX(queue, position);
+    PMPSC_SLOT slot = &queue->slots[index];
+    int merged;
+
+    // Lock the slot against the consumer and other producers
+    if (!PltAtomicCompareExchange(&slot->state, SLOT_READY, SLOT_WRITING)) {
+        return 0;
+    }
+
+    // Make sure the slot still holds the item at this position
+    if (PltAtomicLoad(&slot->sequence) != position + 1) {
+        PltAtomicStore(&slot->state, SLOT_READY);
+        return 0;
+    }
+
+    merged = coalesce(SLOT_ITEM(queue, index), item);
+
+    PltAtomicStore(&slot->state, SLOT_READY);
+    return merged;
+}
+
+// If position is not NULL, it receives the queue position of the item which
+// can be passed to MpscCoalesceItem() later
+int MpscOfferItem(PMPSC_QUEUE queue, const void* item, unsigned int* position) {
+    PMPSC_SLOT slot;
+    unsigned int tail;
+
+    if (queue->shutdown) {
+        return LBQ_INTERRUPTED;
+    }
+
+    // Claim the slot at the tail
+    for (;;) {
+        int diff;
+
+        tail = PltAtomicLoad(&queue->tail);
+        slot = &queue->slots[SLOT_INDEX(queue, tail)];
+        diff = (int)(PltAtomicLoad(&slot->sequence) - tail);
+        if (diff == 0) {
+            if (PltAtomicCompareExchange(&queue->tail, tail, tail + 1)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // The consumer hasn't taken the item in this slot yet
+            return LBQ_BOUND_EXCEEDED;
+        }
+
+        // Another producer claimed this slot first
+    }
+
+    memcpy(SLOT_ITEM(queue, SLOT_INDEX(queue, tail)), item, queue->itemSize);
+
+    // Publish the item to the consumer
+    PltAtomicStore(&slot->state, SLOT_READY);
+    PltAtomicStore(&slot->sequence, tail + 1);
+
+    // Only wake the consumer if it's waiting
+    if (PltAtomicLoad(&queue->consumerWaiting)) {
+        PltSetEvent(&queue->containsDataEvent);
+    }
+
+    if (position != NULL) {
+        *position = tail;
+    }
+
+    return LBQ_SUCCESS;
+}
+
+// Copies the item at the given offset from the head without taking it.
+// Producers can't merge into it during the copy. Must only be called from
+// the consumer thread.
+int MpscPeekItemAt(PMPSC_QUEUE queue, int offset, void* item) {
+    unsigned int position = queue->head + offset;
+    int index = SLOT_INDEX(queue, position);
+    PMPSC_SLOT slot = &queue->slots[index];
+
+    if (offset >= queue->slotCount || PltAtomicLoad(&slot->sequence) != position + 1) {
+        return LBQ_NO_ELEMENT;
+    }
+
+    // Wait for any producer merging into this item to finish
+    while (!PltAtomicCompareExchange(&slot->state, SLOT_READY, SLOT_READING)) {
+        PltSleepMs(0);
+    }
+
+    memcpy(item, SLOT_ITEM(queue, index), queue->itemSize);
+
+    PltAtomicStore(&slot->state, SLOT_READY);
+
+    return LBQ_SUCCESS;
+}
+
+// Must only be called from the consumer thread
+int MpscPeekItem(PMPSC_QUEUE queue, void* item) {
+    return MpscPeekItemAt(queue, 0, item);
+}
+
+// Must only be called from the consumer thread
+int MpscPollItem(PMPSC_QUEUE queue, void* item) {
+    unsigned int head = queue->head;
+    int index = SLOT_INDEX(queue, head);
+    PMPSC_SLOT slot = &queue->slots[index];
+
+    if (PltAtomicLoad(&slot->sequence) != head + 1) {
+        return LBQ_NO_ELEMENT;
+    }
+
+    // Wait for any producer merging into this item to finish
+    while (!PltAtomicCompareExchange(&slot->state, SLOT_READY, SLOT_READING)) {
+        PltSleepMs(0);
+    }
+
+    memcpy(item, SLOT_ITEM(queue, index), queue->itemSize);
+
+    // Return the slot to producers for the next lap around the ring
+    PltAtomicStore(&slot->state, SLOT_FREE);
+    PltAtomicStore(&slot->sequence, head + queue->slotCount);
+    PltAtomicStore(&queue->head, head + 1);
+
+    return LBQ_SUCCESS;
+}
+
+// Waits until an item is available to be taken. Must only be called from
+// the consumer thread.
+int MpscWaitForData(PMPSC_QUEUE queue) {
+    int err;
+
+    for (;;) {
+        if (queue->shutdown) {
+            return LBQ_INTERRUPTED;
+        }
+
+        if (PltAtomicLoad(&queue->slots[SLOT_INDEX(queue, queue->head)].sequence) == queue->head + 1) {
+            return LBQ_SUCCESS;
+        }
+
+        // Tell producers we're about to wait, then check again. Any producer
+        // that publishes after this check will see the flag and wake us.
+        PltClearEvent(&queue->containsDataEvent);
+        PltAtomicStore(&queue->consumerWaiting, 1);
+
+        if (PltAtomicLoad(&queue->slots[SLOT_INDEX(queue, queue->head)].sequence) == queue->head + 1) {
+            PltAtomicStore(&queue->consumerWaiting, 0);
+            return LBQ_SUCCESS;
+        }
+        else if (queue->shutdown) {
+            PltAtomicStore(&queue->consumerWaiting, 0);
+            return LBQ_INTERRUPTED;
+        }
+
+        err = PltWaitForEvent(&queue->containsDataEvent);
+        PltAtomicStore(&queue->consumerWaiting, 0);
+        if (err != PLT_WAIT_SUCCESS) {
+            return LBQ_INTERRUPTED;
+        }
+    }
+}
+
+// Waits up to timeoutMs for the item at the given offset from the head to
+// be available. Returns LBQ_NO_ELEMENT if it isn't. The offset must be less
+// than the queue size, since no producer can fill a slot beyond that until
+// the consumer frees one. Must only be called from the consumer thread.
+int MpscWaitForItemAt(PMPSC_QUEUE queue, int offset, int timeoutMs) {
+    unsigned int position;
+    PMPSC_SLOT slot;
+    uint64_t deadline;
+
+    LC_ASSERT(offset >= 0 && offset < queue->slotCount);
+    if (offset < 0 || offset >= queue->slotCount) {
+        return LBQ_BOUND_EXCEEDED;
+    }
+
+    position = queue->head + offset;
+    slot = &queue->slots[SLOT_INDEX(queue, position)];
+    deadline = PltGetMillis() + timeoutMs;
+
+    for (;;) {
+        uint64_t now;
+        int err;
+
+        if (queue->shutdown) {
+            return LBQ_INTERRUPTED;
+        }
+
+        if (PltAtomicLoad(&slot->sequence) == position + 1) {
+            return LBQ_SUCCESS;
+        }
+
+        now = PltGetMillis();
+        if (now >= deadline) {
+            return LBQ_NO_ELEMENT;
+        }
+
+        // Same handshake with producers as MpscWaitForData()
+        PltClearEvent(&queue->containsDataEvent);
+        PltAtomicStore(&queue->consumerWaiting, 1);
+
+        if (PltAtomicLoad(&slot->sequence) == position + 1) {
+            PltAtomicStore(&queue->consumerWaiting, 0);
+            return LBQ_SUCCESS;
+        }
+        else if (queue->shutdown) {
+            PltAtomicStore(&queue->consumerWaiting, 0);
+            return LBQ_INTERRUPTED;
+        }
+
+        err = PltWaitForEventTimeout(&queue->containsDataEvent, (int)(deadline - now));
+        PltAtomicStore(&queue->consumerWaiting, 0);
+        if (err != PLT_WAIT_SUCCESS && err != PLT_WAIT_TIMEOUT) {
+            return LBQ_INTERRUPTED;
+        }
+    }
+}
+
+// Must only be called from the consumer thread
+int MpscWaitForItem(PMPSC_QUEUE queue, void* item) {
+    int err;
+
+    err = MpscWaitForData(queue);
+    if (err != LBQ_SUCCESS) {
+        return err;
+    }
+
+    return MpscPollItem(queue, item);
+}
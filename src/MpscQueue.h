@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Platform.h"
+#include "PlatformThreads.h"
+#include "LinkedBlockingQueue.h"
+
+// This queue uses the LBQ_* return codes
+
+typedef struct _MPSC_SLOT {
+    // The queue position this slot can be used for next
+    volatile unsigned int sequence;
+    volatile int state;
+} MPSC_SLOT, *PMPSC_SLOT;
+
+// Merges an item into an item that is already queued. Returns non-zero if
+// the new item was merged, or 0 if it must be queued separately.
+typedef int (*MpscCoalesceCallback)(void* queuedItem, const void* newItem);
+
+typedef struct _MPSC_QUEUE {
+    PMPSC_SLOT slots;
+    char* items;
+    int slotCount;
+    int itemSize;
+
+    volatile unsigned int head;
+    volatile unsigned int tail;
+
+    volatile int shutdown;
+    volatile int consumerWaiting;
+    PLT_EVENT containsDataEvent;
+} MPSC_QUEUE, *PMPSC_QUEUE;
+
+int MpscInitializeQueue(PMPSC_QUEUE queue, int slotCount, int itemSize);
+void MpscDestroyQueue(PMPSC_QUEUE queue);
+int MpscOfferItem(PMPSC_QUEUE queue, const void* item, unsigned int* position);
+int MpscCoalesceItem(PMPSC_QUEUE queue, unsigned int position, const void* item, MpscCoalesceCallback coalesce);
+int MpscWaitForData(PMPSC_QUEUE queue);
+int MpscWaitForItem(PMPSC_QUEUE queue, void* item);
+int MpscPollItem(PMPSC_QUEUE queue, void* item);
+int MpscPeekItem(PMPSC_QUEUE queue, void* item);
+int MpscPeekItemAt(PMPSC_QUEUE queue, int offset, void* item);
+int MpscWaitForItemAt(PMPSC_QUEUE queue, int offset, int timeoutMs);
+void MpscSignalQueueShutdown(PMPSC_QUEUE queue);
+int MpscGetItemCount(PMPSC_QUEUE queue);
@@ -6,6 +6,10 @@
 
 #include <enet/enet.h>
 
+#if defined(__vita__)
+#include <psp2/kernel/processmgr.h>
+#endif
+
 // The maximum amount of time before observing an interrupt
 // in PltSleepMsInterruptible().
 #define INTERRUPT_PERIOD_MS 50
@@ -353,6 +357,73 @@ int PltWaitForEvent(PLT_EVENT* event) {
 #endif
 }
 
+// Returns PLT_WAIT_TIMEOUT if the event isn't set within timeoutMs
+int PltWaitForEventTimeout(PLT_EVENT* event, int timeoutMs) {
+#if defined(LC_WINDOWS)
+    DWORD error;
+
+    error = WaitForSingleObjectEx(*event, timeoutMs, FALSE);
+    if (error == WAIT_OBJECT_0) {
+        return PLT_WAIT_SUCCESS;
+    }
+    else if (error == WAIT_TIMEOUT) {
+        return PLT_WAIT_TIMEOUT;
+    }
+    else {
+        LC_ASSERT(0);
+        return -1;
+    }
+#elif defined(__vita__)
+    SceUInt timeoutUs = timeoutMs * 1000;
+    int signalled;
+
+    sceKernelLockMutex(event->mutex, 1, NULL);
+    while (!event->signalled) {
+        // The remaining time is written back to timeoutUs
+        if (sceKernelWaitCond(event->cond, &timeoutUs) < 0) {
+            break;
+        }
+    }
+    signalled = event->signalled;
+    sceKernelUnlockMutex(event->mutex, 1);
+
+    return signalled ? PLT_WAIT_SUCCESS : PLT_WAIT_TIMEOUT;
+#else
+    struct timespec deadline;
+    int signalled;
+
+    // Condition variables wait until an absolute time on the realtime clock
+#if HAVE_CLOCK_GETTIME
+    clock_gettime(CLOCK_REALTIME, &deadline);
+#else
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        deadline.tv_sec = tv.tv_sec;
+        deadline.tv_nsec = tv.tv_usec * 1000;
+    }
+#endif
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&event->mutex);
+    while (!event->signalled) {
+        if (pthread_cond_timedwait(&event->cond, &event->mutex, &deadline) != 0) {
+            break;
+        }
+    }
+    signalled = event->signalled;
+    pthread_mutex_unlock(&event->mutex);
+
+    return signalled ? PLT_WAIT_SUCCESS : PLT_WAIT_TIMEOUT;
+#endif
+}
+
 uint64_t PltGetMillis(void) {
 #if defined(LC_WINDOWS)
     return GetTickCount64();
@@ -371,6 +442,36 @@ uint64_t PltGetMillis(void) {
 #endif
 }
 
+uint64_t PltGetMicroseconds(void) {
+#if defined(LC_WINDOWS)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    // Split the conversion to avoid overflowing the multiplication
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+        ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart;
+#elif defined(__vita__)
+    return sceKernelGetProcessTimeWide();
+#elif HAVE_CLOCK_GETTIME
+    struct timespec tv;
+
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+
+    return ((uint64_t)tv.tv_sec * 1000000) + (tv.tv_nsec / 1000);
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+#endif
+}
+
 int initializePlatform(void) {
     int err;
 
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Platform.h"
+
+// Sequentially consistent atomic operations on aligned 32-bit ints
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+#define PltAtomicLoad(p) ((int)InterlockedOr((volatile LONG*)(p), 0))
+#define PltAtomicStore(p, v) ((void)InterlockedExchange((volatile LONG*)(p), (LONG)(v)))
+#define PltAtomicFetchAdd(p, v) ((int)InterlockedExchangeAdd((volatile LONG*)(p), (LONG)(v)))
+
+// Returns non-zero if *p was equal to expected and has been replaced with desired
+#define PltAtomicCompareExchange(p, expected, desired) \
+    (InterlockedCompareExchange((volatile LONG*)(p), (LONG)(desired), (LONG)(expected)) == (LONG)(expected))
+#elif defined(__GNUC__)
+#define PltAtomicLoad(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define PltAtomicStore(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define PltAtomicFetchAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+
+// Returns non-zero if *p was equal to expected and has been replaced with desired
+#define PltAtomicCompareExchange(p, expected, desired) \
+    __sync_bool_compare_and_swap((p), (expected), (desired))
+#else
+#error Unsupported compiler
+#endif
@@ -148,16 +148,22 @@ int pollSockets(struct pollfd* pollFds, int pollFdsCount, int timeoutMs) {
 }
 
 int recvUdpSocket(SOCKET s, char* buffer, int size, int useSelect) {
+    return recvUdpSocketWithTimeout(s, buffer, size, useSelect, UDP_RECV_POLL_TIMEOUT_MS);
+}
+
+// The timeout only applies if useSelect is set. Otherwise, the socket's
+// SO_RCVTIMEO value is used.
+int recvUdpSocketWithTimeout(SOCKET s, char* buffer, int size, int useSelect, int timeoutMs) {
     int err;
     
     do {
         if (useSelect) {
             struct pollfd pfd;
 
-            // Wait up to 100 ms for the socket to be readable
+            // Wait up to timeoutMs for the socket to be readable
             pfd.fd = s;
             pfd.events = POLLIN;
-            err = pollSockets(&pfd, 1, UDP_RECV_POLL_TIMEOUT_MS);
+            err = pollSockets(&pfd, 1, timeoutMs);
             if (err <= 0) {
                 // Return if an error or timeout occurs
                 return err;
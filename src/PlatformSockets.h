@@ -75,6 +75,7 @@ SOCKET bindUdpSocket(int addrfamily, int bufferSize);
 int enableNoDelay(SOCKET s);
 int setSocketNonBlocking(SOCKET s, int val);
 int recvUdpSocket(SOCKET s, char* buffer, int size, int useSelect);
+int recvUdpSocketWithTimeout(SOCKET s, char* buffer, int size, int useSelect, int timeoutMs);
 void shutdownTcpSocket(SOCKET s);
 int setNonFatalRecvTimeoutMs(SOCKET s, int timeoutMs);
 void setRecvTimeout(SOCKET s, int timeoutSec);
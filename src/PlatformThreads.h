@@ -56,11 +56,13 @@ void PltCloseEvent(PLT_EVENT* event);
 void PltSetEvent(PLT_EVENT* event);
 void PltClearEvent(PLT_EVENT* event);
 int PltWaitForEvent(PLT_EVENT* event);
+int PltWaitForEventTimeout(PLT_EVENT* event, int timeoutMs);
 
 void PltRunThreadProc(void);
 
 #define PLT_WAIT_SUCCESS 0
 #define PLT_WAIT_INTERRUPTED 1
+#define PLT_WAIT_TIMEOUT 2
 
 void PltSleepMs(int ms);
 void PltSleepMsInterruptible(PLT_THREAD* thread, int ms);
@@ -0,0 +1,291 @@
+#include "Limelight-internal.h"
+#include "RtpAudioFecQueue.h"
+
+// GFE doesn't generate audio parity using the same matrix that our RS
+// implementation computes, but the shard counts are fixed, so we can just
+// substitute the parity rows that match the host's encoder.
+static const unsigned char k_AudioFecParityMatrix[RTPA_FEC_SHARDS * RTPA_DATA_SHARDS] = {
+    0x77, 0x40, 0x38, 0x0e,
+    0xc7, 0xa7, 0x0d, 0x6c
+};
+
+void RtpaInitializeQueue(PRTP_AUDIO_FEC_QUEUE queue, unsigned int timestampIncrement) {
+    memset(queue, 0, sizeof(*queue));
+
+    reed_solomon_init();
+    queue->rs = reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS);
+    if (queue->rs != NULL) {
+        memcpy(&queue->rs->m[RTPA_DATA_SHARDS * RTPA_DATA_SHARDS], k_AudioFecParityMatrix, sizeof(k_AudioFecParityMatrix));
+        memcpy(queue->rs->parity, k_AudioFecParityMatrix, sizeof(k_AudioFecParityMatrix));
+    }
+    else {
+        // FEC packets will be ignored
+        Limelog("Audio FEC recovery unavailable\n");
+    }
+
+    // RTP version 2
+    queue->rtpHeader = (char)0x80;
+    queue->lastSequenceNumber = -1;
+    queue->timestampIncrement = timestampIncrement;
+}
+
+void RtpaCleanupQueue(PRTP_AUDIO_FEC_QUEUE queue) {
+    if (queue->rs != NULL) {
+        reed_solomon_release(queue->rs);
+        queue->rs = NULL;
+    }
+}
+
+static PRTPA_DATA_SHARD getDataShard(PRTP_AUDIO_FEC_QUEUE queue, unsigned short sequenceNumber) {
+    PRTPA_DATA_SHARD shard = &queue->dataShards[sequenceNumber & (RTPA_DATA_HISTORY - 1)];
+
+    if (shard->valid && shard->sequenceNumber == sequenceNumber) {
+        return shard;
+    }
+    else {
+        return NULL;
+    }
+}
+
+// Reconstructs any missing data shards in the block if enough shards have arrived
+static void tryRecoverBlock(PRTP_AUDIO_FEC_QUEUE queue, PRTPA_FEC_BLOCK block) {
+    unsigned char* shards[RTPA_TOTAL_SHARDS];
+    unsigned char marks[RTPA_TOTAL_SHARDS];
+    PRTPA_DATA_SHARD dataShards[RTPA_DATA_SHARDS];
+    int missingDataShards;
+    int i;
+
+    if (block->complete || queue->rs == NULL) {
+        return;
+    }
+
+    missingDataShards = 0;
+    for (i = 0; i < RTPA_DATA_SHARDS; i++) {
+        dataShards[i] = getDataShard(queue, U16(block->fecHeader.baseSequenceNumber + i));
+        if (dataShards[i] == NULL) {
+            missingDataShards++;
+        }
+        else if (dataShards[i]->length != block->blockSize) {
+            // We can only recover fixed size (CBR) audio packets because the
+            // original length of a recovered packet isn't known.
+            block->complete = 1;
+            return;
+        }
+    }
+
+    if (missingDataShards == 0) {
+        // Nothing to recover
+        block->complete = 1;
+        return;
+    }
+    else if (missingDataShards > block->fecShardsReceived) {
+        // Not enough shards yet
+        return;
+    }
+
+    for (i = 0; i < RTPA_DATA_SHARDS; i++) {
+        if (dataShards[i] == NULL) {
+            unsigned short sequenceNumber = U16(block->fecHeader.baseSequenceNumber + i);
+
+            // Claim the history slot for the recovered packet unless the
+            // block is so old that the slot holds a newer packet already.
+            dataShards[i] = &queue->dataShards[sequenceNumber & (RTPA_DATA_HISTORY - 1)];
+            if (dataShards[i]->valid && !isBefore16(dataShards[i]->sequenceNumber, sequenceNumber)) {
+                block->complete = 1;
+                return;
+            }
+            marks[i] = 1;
+        }
+        else {
+            marks[i] = 0;
+        }
+        shards[i] = dataShards[i]->data;
+    }
+    for (i = 0; i < RTPA_FEC_SHARDS; i++) {
+        shards[RTPA_DATA_SHARDS + i] = block->fecShards[i];
+        marks[RTPA_DATA_SHARDS + i] = !block->fecShardValid[i];
+    }
+
+    for (i = 0; i < RTPA_DATA_SHARDS; i++) {
+        if (marks[i]) {
+            dataShards[i]->valid = 0;
+        }
+    }
+
+    block->complete = 1;
+
+    if (reed_solomon_reconstruct(queue->rs, shards, marks, RTPA_TOTAL_SHARDS, block->blockSize) != 0) {
+        Limelog("Audio FEC recovery failed for block %d\n", block->fecHeader.baseSequenceNumber);
+        return;
+    }
+
+    for (i = 0; i < RTPA_DATA_SHARDS; i++) {
+        if (marks[i]) {
+            unsigned short sequenceNumber = U16(block->fecHeader.baseSequenceNumber + i);
+
+            dataShards[i]->valid = 1;
+            dataShards[i]->sequenceNumber = sequenceNumber;
+            dataShards[i]->length = block->blockSize;
+
+            if (queue->recoveredCount == RTPA_DATA_SHARDS) {
+                // The caller didn't drain the last recovery
+                LC_ASSERT(queue->recoveredCount < RTPA_DATA_SHARDS);
+                continue;
+            }
+            queue->recoveredSequenceNumbers[queue->recoveredCount] = sequenceNumber;
+            queue->recoveredTimestamps[queue->recoveredCount] =
+                block->fecHeader.baseTimestamp + i * queue->timestampIncrement;
+            queue->recoveredSsrcs[queue->recoveredCount] = block->fecHeader.ssrc;
+            queue->recoveredPayloadTypes[queue->recoveredCount] = block->fecHeader.payloadType;
+            queue->recoveredCount++;
+        }
+    }
+}
+
+// Records a received audio packet. The packet must already be in host byte order.
+void RtpaAddDataPacket(PRTP_AUDIO_FEC_QUEUE queue, PRTP_PACKET packet, int length) {
+    PRTPA_DATA_SHARD shard;
+    int payloadLength;
+    int i;
+
+    payloadLength = length - sizeof(*packet);
+    if (payloadLength <= 0 || payloadLength > RTPA_MAX_SHARD_SIZE) {
+        return;
+    }
+
+    // Learn the timestamp spacing so recovered packets get sensible timestamps
+    if (queue->lastSequenceNumber >= 0 && U16(queue->lastSequenceNumber + 1) == packet->sequenceNumber) {
+        queue->timestampIncrement = packet->timestamp - queue->lastTimestamp;
+    }
+    queue->lastSequenceNumber = packet->sequenceNumber;
+    queue->lastTimestamp = packet->timestamp;
+    queue->rtpHeader = packet->header;
+
+    shard = &queue->dataShards[packet->sequenceNumber & (RTPA_DATA_HISTORY - 1)];
+    if (shard->valid && shard->sequenceNumber == packet->sequenceNumber) {
+        // Duplicate or already recovered
+        return;
+    }
+
+    shard->valid = 1;
+    shard->sequenceNumber = packet->sequenceNumber;
+    shard->length = payloadLength;
+    memcpy(shard->data, packet + 1, payloadLength);
+
+    // This may complete a block whose parity arrived first
+    for (i = 0; i < RTPA_FEC_BLOCKS; i++) {
+        PRTPA_FEC_BLOCK block = &queue->fecBlocks[i];
+
+        if (block->valid && !block->complete &&
+                U16(packet->sequenceNumber - block->fecHeader.baseSequenceNumber) < RTPA_DATA_SHARDS) {
+            tryRecoverBlock(queue, block);
+            break;
+        }
+    }
+}
+
+// Records a received audio FEC packet. Only the RTP header must be in host byte order.
+void RtpaAddFecPacket(PRTP_AUDIO_FEC_QUEUE queue, PRTP_PACKET packet, int length) {
+    PAUDIO_FEC_HEADER fecHeader;
+    PRTPA_FEC_BLOCK block;
+    unsigned short baseSequenceNumber;
+    int blockSize;
+    int i;
+
+    blockSize = length - sizeof(*packet) - sizeof(*fecHeader);
+    if (blockSize <= 0 || blockSize > RTPA_MAX_SHARD_SIZE) {
+        return;
+    }
+
+    fecHeader = (PAUDIO_FEC_HEADER)(packet + 1);
+    if (fecHeader->fecShardIndex >= RTPA_FEC_SHARDS) {
+        return;
+    }
+
+    baseSequenceNumber = htons(fecHeader->baseSequenceNumber);
+
+    block = NULL;
+    for (i = 0; i < RTPA_FEC_BLOCKS; i++) {
+        if (queue->fecBlocks[i].valid && queue->fecBlocks[i].fecHeader.baseSequenceNumber == baseSequenceNumber) {
+            block = &queue->fecBlocks[i];
+            break;
+        }
+    }
+
+    if (block == NULL) {
+        // Replace the oldest block
+        block = &queue->fecBlocks[queue->nextFecBlock];
+        queue->nextFecBlock = (queue->nextFecBlock + 1) % RTPA_FEC_BLOCKS;
+
+        memset(block->fecShardValid, 0, sizeof(block->fecShardValid));
+        block->valid = 1;
+        block->complete = 0;
+        block->fecShardsReceived = 0;
+        block->blockSize = blockSize;
+        block->fecHeader.fecShardIndex = 0;
+        block->fecHeader.payloadType = fecHeader->payloadType;
+        block->fecHeader.baseSequenceNumber = baseSequenceNumber;
+        block->fecHeader.baseTimestamp = htonl(fecHeader->baseTimestamp);
+        block->fecHeader.ssrc = htonl(fecHeader->ssrc);
+    }
+    else if (block->complete || block->fecShardValid[fecHeader->fecShardIndex]) {
+        return;
+    }
+    else if (block->blockSize != blockSize) {
+        LC_ASSERT(block->blockSize == blockSize);
+        return;
+    }
+
+    memcpy(block->fecShards[fecHeader->fecShardIndex], fecHeader + 1, blockSize);
+    block->fecShardValid[fecHeader->fecShardIndex] = 1;
+    block->fecShardsReceived++;
+
+    tryRecoverBlock(queue, block);
+}
+
+int RtpaHasRecoveredPackets(PRTP_AUDIO_FEC_QUEUE queue) {
+    return queue->nextRecoveredIndex < queue->recoveredCount;
+}
+
+// Returns the size of the next recovered packet copied into the buffer in
+// host byte order, or 0 if there are no more recovered packets
+int RtpaGetRecoveredPacket(PRTP_AUDIO_FEC_QUEUE queue, char* buffer, int bufferSize) {
+    PRTP_PACKET packet;
+    PRTPA_DATA_SHARD shard;
+    int length;
+    int i;
+
+    while (queue->nextRecoveredIndex < queue->recoveredCount) {
+        i = queue->nextRecoveredIndex++;
+
+        shard = getDataShard(queue, queue->recoveredSequenceNumbers[i]);
+        if (shard == NULL) {
+            // Overwritten by newer packets already
+            continue;
+        }
+
+        length = sizeof(*packet) + shard->length;
+        if (length > bufferSize) {
+            continue;
+        }
+
+        packet = (PRTP_PACKET)buffer;
+        packet->header = queue->rtpHeader;
+        packet->packetType = queue->recoveredPayloadTypes[i];
+        packet->sequenceNumber = shard->sequenceNumber;
+        packet->timestamp = queue->recoveredTimestamps[i];
+        packet->ssrc = queue->recoveredSsrcs[i];
+        memcpy(packet + 1, shard->data, shard->length);
+
+        // Make room for the next block's recovered packets once the last
+        // one has been handed out, since callers stop asking at that point.
+        if (queue->nextRecoveredIndex == queue->recoveredCount) {
+            queue->recoveredCount = queue->nextRecoveredIndex = 0;
+        }
+
+        return length;
+    }
+
+    queue->recoveredCount = queue->nextRecoveredIndex = 0;
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Video.h"
+#include "rs.h"
+
+#define RTPA_DATA_SHARDS 4
+#define RTPA_FEC_SHARDS 2
+#define RTPA_TOTAL_SHARDS (RTPA_DATA_SHARDS + RTPA_FEC_SHARDS)
+
+// RTP payload type of audio FEC packets
+#define RTPA_FEC_PAYLOAD_TYPE 127
+
+// Largest audio datagram we will receive
+#define RTPA_MAX_PACKET_SIZE 1400
+#define RTPA_MAX_SHARD_SIZE (RTPA_MAX_PACKET_SIZE - (int)sizeof(RTP_PACKET))
+
+// Number of recent data packets remembered for recovery (power of 2)
+#define RTPA_DATA_HISTORY 16
+
+// Number of FEC blocks tracked at once
+#define RTPA_FEC_BLOCKS 4
+
+#pragma pack(push, 1)
+
+// Follows the RTP header in audio FEC packets
+typedef struct _AUDIO_FEC_HEADER {
+    unsigned char fecShardIndex;
+    unsigned char payloadType;
+    unsigned short baseSequenceNumber;
+    unsigned int baseTimestamp;
+    unsigned int ssrc;
+} AUDIO_FEC_HEADER, *PAUDIO_FEC_HEADER;
+
+#pragma pack(pop)
+
+typedef struct _RTPA_DATA_SHARD {
+    int valid;
+    unsigned short sequenceNumber;
+    int length;
+    unsigned char data[RTPA_MAX_SHARD_SIZE];
+} RTPA_DATA_SHARD, *PRTPA_DATA_SHARD;
+
+typedef struct _RTPA_FEC_BLOCK {
+    int valid;
+    int complete;
+    AUDIO_FEC_HEADER fecHeader;
+    int blockSize;
+    int fecShardsReceived;
+    unsigned char fecShardValid[RTPA_FEC_SHARDS];
+    unsigned char fecShards[RTPA_FEC_SHARDS][RTPA_MAX_SHARD_SIZE];
+} RTPA_FEC_BLOCK, *PRTPA_FEC_BLOCK;
+
+typedef struct _RTP_AUDIO_FEC_QUEUE {
+    reed_solomon* rs;
+
+    RTPA_DATA_SHARD dataShards[RTPA_DATA_HISTORY];
+    RTPA_FEC_BLOCK fecBlocks[RTPA_FEC_BLOCKS];
+    int nextFecBlock;
+
+    // Recovered packets waiting to be returned by RtpaGetRecoveredPacket()
+    unsigned short recoveredSequenceNumbers[RTPA_DATA_SHARDS];
+    unsigned int recoveredTimestamps[RTPA_DATA_SHARDS];
+    unsigned int recoveredSsrcs[RTPA_DATA_SHARDS];
+    unsigned char recoveredPayloadTypes[RTPA_DATA_SHARDS];
+    int recoveredCount;
+    int nextRecoveredIndex;
+
+    // Used to reconstruct the timestamps of recovered packets
+    char rtpHeader;
+    int lastSequenceNumber;
+    unsigned int lastTimestamp;
+    unsigned int timestampIncrement;
+} RTP_AUDIO_FEC_QUEUE, *PRTP_AUDIO_FEC_QUEUE;
+
+void RtpaInitializeQueue(PRTP_AUDIO_FEC_QUEUE queue, unsigned int timestampIncrement);
+void RtpaCleanupQueue(PRTP_AUDIO_FEC_QUEUE queue);
+void RtpaAddDataPacket(PRTP_AUDIO_FEC_QUEUE queue, PRTP_PACKET packet, int length);
+void RtpaAddFecPacket(PRTP_AUDIO_FEC_QUEUE queue, PRTP_PACKET packet, int length);
+int RtpaHasRecoveredPackets(PRTP_AUDIO_FEC_QUEUE queue);
+int RtpaGetRecoveredPacket(PRTP_AUDIO_FEC_QUEUE queue, char* buffer, int bufferSize);
@@ -0,0 +1,141 @@
+#include "Limelight-internal.h"
+#include "RtpClockDrift.h"
+
+// Estimates how fast the host's audio clock runs relative to ours by comparing
+// the progression of RTP timestamps with local receive times. The lowest delay
+// seen in each window is used, since it's least affected by network queuing,
+// and a line is fit through the recent window minimums. The slope of that line
+// is the drift between the two clocks.
+
+void RtpdInitialize(PRTP_CLOCK_DRIFT drift, int packetDurationMs) {
+    memset(drift, 0, sizeof(*drift));
+    drift->packetDurationMs = packetDurationMs;
+}
+
+// The host may send timestamps in milliseconds or in 48 KHz samples, so we
+// determine which by comparing the increment to the packet duration.
+static void detectClockRate(PRTP_CLOCK_DRIFT drift, PRTP_PACKET packet) {
+    unsigned int increment;
+
+    if (U16(packet->sequenceNumber - drift->lastSequenceNumber) != 1) {
+        // Wait for consecutive packets
+        return;
+    }
+
+    increment = U32(packet->timestamp - drift->lastTimestamp);
+    if (increment == (unsigned int)drift->packetDurationMs) {
+        drift->clockRate = 1000;
+    }
+    else if (increment == (unsigned int)drift->packetDurationMs * 48) {
+        drift->clockRate = 48000;
+    }
+    else {
+        Limelog("Unable to determine audio RTP clock rate (increment: %u)\n", increment);
+        drift->clockRate = -1;
+    }
+}
+
+static void closeWindow(PRTP_CLOCK_DRIFT drift, int64_t windowEndUs) {
+    double sumX, sumY, sumXY, sumXX, slope, denominator;
+    int64_t baseX, baseY;
+    int i;
+
+    drift->windows[drift->nextWindow].midTimeUs = (drift->windowStartUs + windowEndUs) / 2;
+    drift->windows[drift->nextWindow].minDelayUs = drift->windowMinDelayUs;
+    drift->nextWindow = (drift->nextWindow + 1) % RTPD_WINDOW_HISTORY;
+    if (drift->windowCount < RTPD_WINDOW_HISTORY) {
+        drift->windowCount++;
+    }
+
+    if (drift->windowCount < RTPD_MIN_WINDOWS) {
+        return;
+    }
+
+    // Least squares fit relative to the first window to preserve precision
+    baseX = drift->windows[0].midTimeUs;
+    baseY = drift->windows[0].minDelayUs;
+    sumX = sumY = sumXY = sumXX = 0;
+    for (i = 0; i < drift->windowCount; i++) {
+        double x = (double)(drift->windows[i].midTimeUs - baseX);
+        double y = (double)(drift->windows[i].minDelayUs - baseY);
+
+        sumX += x;
+        sumY += y;
+        sumXY += x * y;
+        sumXX += x * x;
+    }
+
+    denominator = drift->windowCount * sumXX - sumX * sumX;
+    if (denominator <= 0) {
+        return;
+    }
+    slope = (drift->windowCount * sumXY - sumX * sumY) / denominator;
+
+    // If the host clock is fast, its timestamps advance faster than our
+    // clock and the delay shrinks over time.
+    drift->driftPpm = (int)(-slope * 1000000 + (slope < 0 ? 0.5 : -0.5));
+    drift->driftValid = 1;
+}
+
+// Called with each audio packet received from the network in host byte order.
+// Packets rebuilt from FEC data should not be passed in, since their receive
+// time doesn't reflect when they were sent.
+void RtpdAddPacket(PRTP_CLOCK_DRIFT drift, PRTP_PACKET packet, uint64_t receiveTimeUs) {
+    int64_t timestampDelta;
+    int64_t mediaTimeUs, localTimeUs, delayUs;
+
+    if (!drift->havePacket) {
+        drift->havePacket = 1;
+        drift->lastSequenceNumber = packet->sequenceNumber;
+        drift->lastTimestamp = packet->timestamp;
+        drift->extendedTimestamp = 0;
+        drift->baseTimeUs = receiveTimeUs;
+        drift->windowStartUs = 0;
+        drift->windowMinDelayUs = INT64_MAX;
+        return;
+    }
+
+    if (drift->clockRate == 0) {
+        detectClockRate(drift, packet);
+    }
+
+    // Extend the timestamp relative to the newest one, allowing for
+    // reordered packets and wraparound
+    timestampDelta = (int32_t)U32(packet->timestamp - drift->lastTimestamp);
+    if (timestampDelta > 0) {
+        drift->extendedTimestamp += timestampDelta;
+        drift->lastTimestamp = packet->timestamp;
+        timestampDelta = 0;
+    }
+    if (isBefore16(drift->lastSequenceNumber, packet->sequenceNumber)) {
+        drift->lastSequenceNumber = packet->sequenceNumber;
+    }
+
+    if (drift->clockRate <= 0) {
+        return;
+    }
+
+    localTimeUs = (int64_t)(receiveTimeUs - drift->baseTimeUs);
+    mediaTimeUs = (drift->extendedTimestamp + timestampDelta) * 1000000 / drift->clockRate;
+    delayUs = localTimeUs - mediaTimeUs;
+
+    if (delayUs < drift->windowMinDelayUs) {
+        drift->windowMinDelayUs = delayUs;
+    }
+
+    if (localTimeUs - drift->windowStartUs >= RTPD_WINDOW_US) {
+        closeWindow(drift, localTimeUs);
+        drift->windowStartUs = localTimeUs;
+        drift->windowMinDelayUs = INT64_MAX;
+    }
+}
+
+// Returns 0 and the drift in parts per million if an estimate is available
+int RtpdGetDriftPpm(PRTP_CLOCK_DRIFT drift, int* driftPpm) {
+    if (!drift->driftValid) {
+        return -1;
+    }
+
+    *driftPpm = drift->driftPpm;
+    return 0;
+}
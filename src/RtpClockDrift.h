@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Video.h"
+
+// Lowest receive delay is tracked over windows of this length
+#define RTPD_WINDOW_US 2000000
+
+// Number of windows used for the drift estimate (about 2 minutes)
+#define RTPD_WINDOW_HISTORY 64
+
+// Number of windows needed before an estimate is available
+#define RTPD_MIN_WINDOWS 8
+
+typedef struct _RTPD_WINDOW {
+    int64_t midTimeUs;
+    int64_t minDelayUs;
+} RTPD_WINDOW, *PRTPD_WINDOW;
+
+typedef struct _RTP_CLOCK_DRIFT {
+    int packetDurationMs;
+
+    // RTP timestamp clock rate. 0 until detected and -1 if unknown.
+    int clockRate;
+
+    unsigned short lastSequenceNumber;
+    unsigned int lastTimestamp;
+    int64_t extendedTimestamp;
+
+    uint64_t baseTimeUs;
+    int havePacket;
+
+    // Current window
+    int64_t windowStartUs;
+    int64_t windowMinDelayUs;
+
+    RTPD_WINDOW windows[RTPD_WINDOW_HISTORY];
+    int windowCount;
+    int nextWindow;
+
+    // Latest estimate in parts per million
+    volatile int driftPpm;
+    volatile int driftValid;
+} RTP_CLOCK_DRIFT, *PRTP_CLOCK_DRIFT;
+
+void RtpdInitialize(PRTP_CLOCK_DRIFT drift, int packetDurationMs);
+void RtpdAddPacket(PRTP_CLOCK_DRIFT drift, PRTP_PACKET packet, uint64_t receiveTimeUs);
+int RtpdGetDriftPpm(PRTP_CLOCK_DRIFT drift, int* driftPpm);
@@ -9,11 +9,19 @@
 #define FEC_VALIDATION_MODE
 #endif
 
-void RtpfInitializeQueue(PRTP_FEC_QUEUE queue) {
+// An incomplete frame is abandoned once none of its packets have arrived for
+// this many frame intervals (plus the reorder time)
+#define FRAME_TIMEOUT_INTERVALS 2
+
+void RtpfInitializeQueue(PRTP_FEC_QUEUE queue, int maxReorderTimeMs) {
     reed_solomon_init();
     memset(queue, 0, sizeof(*queue));
     
     queue->currentFrameNumber = UINT16_MAX;
+    queue->nextBlockSequenceNumber = -1;
+    queue->maxReorderTimeMs = maxReorderTimeMs;
+    queue->frameTimeoutMs = maxReorderTimeMs +
+        (StreamConfig.fps > 0 ? FRAME_TIMEOUT_INTERVALS * 1000 / StreamConfig.fps : 100);
 }
 
 void RtpfCleanupQueue(PRTP_FEC_QUEUE queue) {
@@ -22,6 +30,12 @@ void RtpfCleanupQueue(PRTP_FEC_QUEUE queue) {
         queue->bufferHead = entry->next;
         free(entry->packet);
     }
+
+    while (queue->heldHead != NULL) {
+        PRTPFEC_QUEUE_ENTRY entry = queue->heldHead;
+        queue->heldHead = entry->next;
+        free(entry->packet);
+    }
 }
 
 // newEntry is contained within the packet buffer so we free the whole entry by freeing entry->packet
@@ -398,12 +412,63 @@ static void submitCompletedFrame(PRTP_FEC_QUEUE queue) {
     }
 }
 
-int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
-    if (isBefore16(packet->sequenceNumber, queue->nextContiguousSequenceNumber)) {
-        // Reject packets behind our current buffer window
-        return RTPF_RET_REJECTED;
+// Passes the outcome of the current frame to the connection quality estimator
+static void reportFinishedFrame(PRTP_FEC_QUEUE queue, int completed) {
+    connectionQualityAddFrame(queue->currentFrameNumber, queue->bufferTimestamp, queue->bufferFirstRecvTimeUs,
+                              queue->bufferDataPackets, queue->bufferParityPackets,
+                              queue->bufferDataPackets - queue->receivedBufferDataPackets,
+                              queue->bufferSkippedPackets, completed);
+}
+
+// Drops the current frame's packets and reports them as lost
+static void abandonCurrentFrame(PRTP_FEC_QUEUE queue) {
+    Limelog("Unrecoverable frame %d: %d+%d=%d received < %d needed\n",
+            queue->currentFrameNumber, queue->receivedBufferDataPackets,
+            queue->bufferSize - queue->receivedBufferDataPackets,
+            queue->bufferSize,
+            queue->bufferDataPackets);
+
+    // Report the data packets that FEC couldn't recover
+    connectionLostPackets(queue->bufferDataPackets - queue->receivedBufferDataPackets);
+    reportFinishedFrame(queue, 0);
+
+    while (queue->bufferHead != NULL) {
+        PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
+        queue->bufferHead = entry->next;
+        free(entry->packet);
+    }
+
+    queue->bufferTail = NULL;
+    queue->bufferSize = 0;
+}
+
+// Abandons the current frame before packets from the next frame arrive and
+// starts recovery for it right away
+static void abandonCurrentFrameEarly(PRTP_FEC_QUEUE queue) {
+    abandonCurrentFrame(queue);
+    connectionDetectedFrameLoss(queue->currentFrameNumber, queue->currentFrameNumber);
+
+    // Ignore any more packets for this frame
+    queue->currentFrameNumber++;
+}
+
+// Returns whether more packets below the highest one received are missing
+// than parity can repair. The missing packets may still just be reordered,
+// so the frame is only abandoned if this stays true for maxReorderTimeMs.
+// It's only checked when FEC is in use, since a single reordered packet
+// would trip it otherwise.
+static int isCurrentFrameUnrecoverable(PRTP_FEC_QUEUE queue) {
+    int missingPackets;
+
+    if (AppVersionQuad[0] < 5 || queue->bufferParityPackets == 0) {
+        return 0;
     }
 
+    missingPackets = U16(queue->highestReceivedSequenceNumber - queue->bufferLowestSequenceNumber) + 1 - queue->bufferSize;
+    return missingPackets > queue->bufferParityPackets;
+}
+
+static int getDataOffset(PRTP_PACKET packet) {
     // FLAG_EXTENSION is required for all supported versions of GFE.
     LC_ASSERT(packet->header & FLAG_EXTENSION);
 
@@ -412,6 +477,16 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
         dataOffset += 4; // 2 additional fields
     }
 
+    return dataOffset;
+}
+
+static int addPacketToFrame(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    if (isBefore16(packet->sequenceNumber, queue->nextContiguousSequenceNumber)) {
+        // Reject packets behind our current buffer window
+        return RTPF_RET_REJECTED;
+    }
+
+    int dataOffset = getDataOffset(packet);
     PNV_VIDEO_PACKET nvPacket = (PNV_VIDEO_PACKET)(((char*)packet) + dataOffset);
     
     if (isBefore16(nvPacket->frameIndex, queue->currentFrameNumber)) {
@@ -425,26 +500,15 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
     // if we can't finish a frame before receiving the next one.
     if (queue->bufferSize == 0 || queue->currentFrameNumber != nvPacket->frameIndex) {
         if (queue->currentFrameNumber != nvPacket->frameIndex && queue->bufferSize != 0) {
-            Limelog("Unrecoverable frame %d: %d+%d=%d received < %d needed\n",
-                    queue->currentFrameNumber, queue->receivedBufferDataPackets,
-                    queue->bufferSize - queue->receivedBufferDataPackets,
-                    queue->bufferSize,
-                    queue->bufferDataPackets);
+            // Discard any unsubmitted buffers from the previous frame
+            abandonCurrentFrame(queue);
         }
         
         queue->currentFrameNumber = nvPacket->frameIndex;
         
-        // Discard any unsubmitted buffers from the previous frame
-        while (queue->bufferHead != NULL) {
-            PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-            queue->bufferHead = entry->next;
-            free(entry->packet);
-        }
-        
-        queue->bufferTail = NULL;
-        queue->bufferSize = 0;
-        
         queue->bufferFirstRecvTimeMs = PltGetMillis();
+        queue->bufferFirstRecvTimeUs = PltGetMicroseconds();
+        queue->bufferTimestamp = packet->timestamp;
         queue->bufferLowestSequenceNumber = U16(packet->sequenceNumber - fecIndex);
         queue->nextContiguousSequenceNumber = queue->bufferLowestSequenceNumber;
         queue->receivedBufferDataPackets = 0;
@@ -453,6 +517,20 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
         queue->bufferParityPackets = (queue->bufferDataPackets * queue->fecPercentage + 99) / 100;
         queue->bufferFirstParitySequenceNumber = U16(queue->bufferLowestSequenceNumber + queue->bufferDataPackets);
         queue->bufferHighestSequenceNumber = U16(queue->bufferFirstParitySequenceNumber + queue->bufferParityPackets - 1);
+        queue->highestReceivedSequenceNumber = U16(queue->bufferLowestSequenceNumber - 1);
+        queue->bufferUnrecoverableTimeMs = 0;
+        queue->bufferProgressTimeMs = queue->bufferFirstRecvTimeMs;
+        queue->bufferProgressSize = 1;
+        queue->newDeadline = 1;
+
+        // Report any packets between the last FEC block and this one
+        queue->bufferSkippedPackets = 0;
+        if (queue->nextBlockSequenceNumber >= 0 &&
+                isBefore16(queue->nextBlockSequenceNumber, queue->bufferLowestSequenceNumber)) {
+            queue->bufferSkippedPackets = U16(queue->bufferLowestSequenceNumber - queue->nextBlockSequenceNumber);
+            connectionLostPackets(queue->bufferSkippedPackets);
+        }
+        queue->nextBlockSequenceNumber = U16(queue->bufferHighestSequenceNumber + 1);
     } else if (isBefore16(queue->bufferHighestSequenceNumber, packet->sequenceNumber)) {
         // In rare cases, we get extra parity packets. It's rare enough that it's probably
         // not worth handling, so we'll just drop them.
@@ -471,6 +549,9 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
         if (isBefore16(packet->sequenceNumber, queue->bufferFirstParitySequenceNumber)) {
             queue->receivedBufferDataPackets++;
         }
+        if (isBefore16(queue->highestReceivedSequenceNumber, packet->sequenceNumber)) {
+            queue->highestReceivedSequenceNumber = packet->sequenceNumber;
+        }
         
         // Try to submit this frame. If we haven't received enough packets,
         // this will fail and we'll keep waiting.
@@ -482,12 +563,187 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
             LC_ASSERT(queue->bufferHead == NULL);
             LC_ASSERT(queue->bufferTail == NULL);
             LC_ASSERT(queue->bufferSize == 0);
-            
+
+            reportFinishedFrame(queue, 1);
+
             // Ignore any more packets for this frame
             queue->currentFrameNumber++;
         }
+        else if (isCurrentFrameUnrecoverable(queue)) {
+            // This only samples the time while the frame is short of packets,
+            // which lasts for maxReorderTimeMs at most.
+            uint64_t now = PltGetMillis();
+
+            if (queue->bufferUnrecoverableTimeMs == 0) {
+                queue->bufferUnrecoverableTimeMs = now;
+                queue->newDeadline = 1;
+            }
+            if (now - queue->bufferUnrecoverableTimeMs >= (uint64_t)queue->maxReorderTimeMs) {
+                abandonCurrentFrameEarly(queue);
+            }
+        }
+        else {
+            // The missing packets were only reordered
+            queue->bufferUnrecoverableTimeMs = 0;
+        }
 
         return RTPF_RET_QUEUED;
     }
 }
 
+// Returns whether the packet belongs to a later frame that must wait for
+// the current incomplete frame to finish
+static int shouldHoldPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet) {
+    PNV_VIDEO_PACKET nvPacket;
+
+    if (queue->maxReorderTimeMs == 0 || queue->bufferSize == 0) {
+        return 0;
+    }
+
+    nvPacket = (PNV_VIDEO_PACKET)(((char*)packet) + getDataOffset(packet));
+    return isBefore16(queue->currentFrameNumber, nvPacket->frameIndex);
+}
+
+static void holdPacket(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY entry) {
+    entry->next = NULL;
+    entry->prev = queue->heldTail;
+
+    if (queue->heldTail != NULL) {
+        queue->heldTail->next = entry;
+    }
+    else {
+        queue->heldHead = entry;
+        queue->newDeadline = 1;
+    }
+    queue->heldTail = entry;
+}
+
+// Passes held packets to the current frame, holding them again if they are
+// still waiting on an incomplete frame and their deadline hasn't passed.
+// Expired packets are submitted even if that abandons the current frame.
+static void releaseHeldPackets(PRTP_FEC_QUEUE queue, uint64_t now) {
+    PRTPFEC_QUEUE_ENTRY entry;
+
+    entry = queue->heldHead;
+    queue->heldHead = queue->heldTail = NULL;
+
+    while (entry != NULL) {
+        PRTPFEC_QUEUE_ENTRY nextEntry = entry->next;
+
+        if (now - entry->receiveTimeMs < (uint64_t)queue->maxReorderTimeMs &&
+                shouldHoldPacket(queue, entry->packet)) {
+            holdPacket(queue, entry);
+        }
+        else if (addPacketToFrame(queue, entry->packet, entry->length, entry) != RTPF_RET_QUEUED) {
+            free(entry->packet);
+        }
+
+        entry = nextEntry;
+    }
+}
+
+// Submits held packets whose reorder deadline has passed. This must be called
+// periodically if no packets are being received.
+void RtpfReleaseExpiredPackets(PRTP_FEC_QUEUE queue) {
+    // The oldest held packet is always at the head
+    if (queue->heldHead != NULL) {
+        uint64_t now = PltGetMillis();
+
+        if (now - queue->heldHead->receiveTimeMs >= (uint64_t)queue->maxReorderTimeMs) {
+            releaseHeldPackets(queue, now);
+        }
+    }
+}
+
+// Returns whether a deadline was added since the last RtpfGetNextDeadlineMs()
+// call. Until then, the receive loop can keep waiting on its cached deadline
+// without sampling the time for each packet.
+int RtpfHasNewDeadline(PRTP_FEC_QUEUE queue) {
+    return queue->newDeadline;
+}
+
+// Returns the number of milliseconds until RtpfReleaseExpiredPackets() will
+// release held packets or RtpfAbandonStalledFrame() may abandon the current
+// frame, or -1 if neither is pending. The receive loop uses this to avoid
+// waiting on the socket past either deadline.
+int RtpfGetNextDeadlineMs(PRTP_FEC_QUEUE queue, uint64_t now) {
+    uint64_t deadlineMs;
+
+    queue->newDeadline = 0;
+
+    if (queue->heldHead == NULL && queue->bufferSize == 0) {
+        return -1;
+    }
+
+    deadlineMs = UINT64_MAX;
+    if (queue->heldHead != NULL) {
+        deadlineMs = queue->heldHead->receiveTimeMs + queue->maxReorderTimeMs;
+    }
+    if (queue->bufferSize != 0 &&
+            queue->bufferProgressTimeMs + queue->frameTimeoutMs < deadlineMs) {
+        deadlineMs = queue->bufferProgressTimeMs + queue->frameTimeoutMs;
+    }
+    if (queue->bufferUnrecoverableTimeMs != 0 &&
+            queue->bufferUnrecoverableTimeMs + queue->maxReorderTimeMs < deadlineMs) {
+        deadlineMs = queue->bufferUnrecoverableTimeMs + queue->maxReorderTimeMs;
+    }
+
+    return deadlineMs > now ? (int)(deadlineMs - now) : 0;
+}
+
+// Abandons the current frame if none of its packets have arrived for
+// frameTimeoutMs or it has been missing more packets than parity can repair
+// for longer than the reorder time. This catches frames whose remaining
+// packets were lost along with any following frames, which would otherwise go
+// unnoticed until the host sends another frame. The receive loop calls it
+// once RtpfGetNextDeadlineMs() says a deadline has passed.
+void RtpfAbandonStalledFrame(PRTP_FEC_QUEUE queue, uint64_t now) {
+    if (queue->bufferSize == 0) {
+        return;
+    }
+
+    if (now - queue->bufferProgressTimeMs >= (uint64_t)queue->frameTimeoutMs &&
+            queue->bufferSize != queue->bufferProgressSize) {
+        // Packets arrived since the last check, so the frame is still coming
+        // in. A large IDR frame on a slow link can take a while, and cutting
+        // it off would just request another one.
+        queue->bufferProgressTimeMs = now;
+        queue->bufferProgressSize = queue->bufferSize;
+    }
+
+    if (now - queue->bufferProgressTimeMs >= (uint64_t)queue->frameTimeoutMs ||
+            (queue->bufferUnrecoverableTimeMs != 0 &&
+             now - queue->bufferUnrecoverableTimeMs >= (uint64_t)queue->maxReorderTimeMs)) {
+        abandonCurrentFrameEarly(queue);
+
+        // Held packets no longer need to wait for this frame
+        if (queue->heldHead != NULL) {
+            releaseHeldPackets(queue, now);
+        }
+    }
+}
+
+int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    int ret;
+
+    RtpfReleaseExpiredPackets(queue);
+
+    // Hold packets that arrive for a later frame while the current frame is
+    // missing packets. They may simply have overtaken the missing packets.
+    if (shouldHoldPacket(queue, packet)) {
+        packetEntry->packet = packet;
+        packetEntry->length = length;
+        packetEntry->receiveTimeMs = PltGetMillis();
+        holdPacket(queue, packetEntry);
+        return RTPF_RET_QUEUED;
+    }
+
+    ret = addPacketToFrame(queue, packet, length, packetEntry);
+
+    // If that completed the current frame, held packets can proceed now
+    if (queue->bufferSize == 0 && queue->heldHead != NULL) {
+        releaseHeldPackets(queue, PltGetMillis());
+    }
+
+    return ret;
+}
@@ -17,6 +17,9 @@ typedef struct _RTP_FEC_QUEUE {
     PRTPFEC_QUEUE_ENTRY bufferHead;
     PRTPFEC_QUEUE_ENTRY bufferTail;
     unsigned long long bufferFirstRecvTimeMs;
+    uint64_t bufferFirstRecvTimeUs;
+    unsigned int bufferTimestamp;
+    int bufferSkippedPackets;
     int bufferSize;
     int bufferLowestSequenceNumber;
     int bufferHighestSequenceNumber;
@@ -28,12 +31,44 @@ typedef struct _RTP_FEC_QUEUE {
     int nextContiguousSequenceNumber;
 
     int currentFrameNumber;
+
+    // The highest sequence number received for the current frame. The frame
+    // is abandoned early if more packets below it have been missing than
+    // parity can recover for maxReorderTimeMs since bufferUnrecoverableTimeMs,
+    // or if none of its packets arrive for frameTimeoutMs. To avoid sampling
+    // the time for each packet, arrivals are noticed by comparing bufferSize
+    // against bufferProgressSize when the timeout expires.
+    int highestReceivedSequenceNumber;
+    unsigned long long bufferUnrecoverableTimeMs;
+    unsigned long long bufferProgressTimeMs;
+    int bufferProgressSize;
+    int frameTimeoutMs;
+
+    // The first sequence number after the current frame's FEC block, or -1.
+    // Packets between this and the start of the next block belong to frames
+    // that were lost entirely.
+    int nextBlockSequenceNumber;
+
+    // Packets for later frames that arrived before the current frame
+    // was complete. These are held for up to maxReorderTimeMs in case
+    // the missing packets of the current frame were just reordered.
+    PRTPFEC_QUEUE_ENTRY heldHead;
+    PRTPFEC_QUEUE_ENTRY heldTail;
+    int maxReorderTimeMs;
+
+    // Set when a deadline is added that may be earlier than the one last
+    // returned by RtpfGetNextDeadlineMs()
+    int newDeadline;
 } RTP_FEC_QUEUE, *PRTP_FEC_QUEUE;
 
 #define RTPF_RET_QUEUED    0
 #define RTPF_RET_REJECTED  1
 
-void RtpfInitializeQueue(PRTP_FEC_QUEUE queue);
+void RtpfInitializeQueue(PRTP_FEC_QUEUE queue, int maxReorderTimeMs);
 void RtpfCleanupQueue(PRTP_FEC_QUEUE queue);
 int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry);
 void RtpfSubmitQueuedPackets(PRTP_FEC_QUEUE queue);
+void RtpfReleaseExpiredPackets(PRTP_FEC_QUEUE queue);
+void RtpfAbandonStalledFrame(PRTP_FEC_QUEUE queue, uint64_t now);
+int RtpfHasNewDeadline(PRTP_FEC_QUEUE queue);
+int RtpfGetNextDeadlineMs(PRTP_FEC_QUEUE queue, uint64_t now);
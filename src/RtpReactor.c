@@ -0,0 +1,203 @@
+#include "Limelight-internal.h"
+#include "PlatformSockets.h"
+#include "PlatformThreads.h"
+#include "RtpReactor.h"
+
+// Audio and video
+#define MAX_HANDLERS 2
+
+#define PING_INTERVAL_MS 500
+
+// The maximum number of datagrams read from a single socket before
+// giving other sockets a chance to be serviced
+#define MAX_RECEIVE_BATCH 32
+
+static PLT_MUTEX reactorMutex;
+static PLT_THREAD reactorThread;
+
+static PRTP_REACTOR_HANDLER handlers[MAX_HANDLERS];
+static int handlerCount;
+static unsigned int handlerGeneration;
+
+static void ReactorThreadProc(void* context) {
+    struct pollfd pollFds[MAX_HANDLERS];
+    PRTP_REACTOR_HANDLER polledHandlers[MAX_HANDLERS];
+    unsigned int generation;
+    uint64_t now;
+    int pollCount;
+    int timeoutMs;
+    int err;
+    int i;
+
+    while (!PltIsThreadInterrupted(&reactorThread)) {
+        timeoutMs = UDP_RECV_POLL_TIMEOUT_MS;
+        pollCount = 0;
+
+        PltLockMutex(&reactorMutex);
+
+        // Service pings and receive timeouts that are due
+        now = PltGetMillis();
+        for (i = 0; i < handlerCount; i++) {
+            PRTP_REACTOR_HANDLER handler = handlers[i];
+
+            if (handler->failed) {
+                continue;
+            }
+
+            if (now >= handler->nextPingTimeMs) {
+                if (handler->ping() < 0) {
+                    handler->failed = 1;
+                    continue;
+                }
+
+                handler->nextPingTimeMs = now + PING_INTERVAL_MS;
+            }
+
+            if (now - handler->lastActivityTimeMs >= UDP_RECV_POLL_TIMEOUT_MS) {
+                if (handler->timeout() < 0) {
+                    handler->failed = 1;
+                    continue;
+                }
+
+                handler->lastActivityTimeMs = now;
+            }
+
+            // Wake up in time for the next ping, receive timeout, or deadline
+            if ((int)(handler->nextPingTimeMs - now) < timeoutMs) {
+                timeoutMs = (int)(handler->nextPingTimeMs - now);
+            }
+            if ((int)(handler->lastActivityTimeMs + UDP_RECV_POLL_TIMEOUT_MS - now) < timeoutMs) {
+                timeoutMs = (int)(handler->lastActivityTimeMs + UDP_RECV_POLL_TIMEOUT_MS - now);
+            }
+            if (handler->serviceDeadlines != NULL) {
+                int deadlineMs = handler->serviceDeadlines(now);
+
+                if (deadlineMs >= 0 && deadlineMs < timeoutMs) {
+                    timeoutMs = deadlineMs;
+                }
+            }
+
+            pollFds[pollCount].fd = handler->socket;
+            pollFds[pollCount].events = POLLIN;
+            polledHandlers[pollCount] = handler;
+            pollCount++;
+        }
+
+        generation = handlerGeneration;
+
+        PltUnlockMutex(&reactorMutex);
+
+        if (pollCount == 0) {
+            // Nothing to wait on until a handler is added
+            PltSleepMsInterruptible(&reactorThread, UDP_RECV_POLL_TIMEOUT_MS);
+            continue;
+        }
+
+        err = pollSockets(pollFds, pollCount, timeoutMs);
+        if (err < 0) {
+            Limelog("RTP reactor: pollSockets() failed: %d\n", (int)LastSocketError());
+            ListenerCallbacks.connectionTerminated(LastSocketFail());
+            break;
+        }
+        else if (err == 0) {
+            // Timed out; pings, receive timeouts, and deadlines are handled above
+            continue;
+        }
+
+        PltLockMutex(&reactorMutex);
+
+        // Only dispatch if no handlers were added or removed while we were polling
+        if (generation == handlerGeneration) {
+            now = PltGetMillis();
+            for (i = 0; i < pollCount; i++) {
+                PRTP_REACTOR_HANDLER handler = polledHandlers[i];
+
+                if (pollFds[i].revents == 0) {
+                    continue;
+                }
+
+                if (handler->receive(handler->maxBatchSize) < 0) {
+                    handler->failed = 1;
+                }
+                else {
+                    handler->lastActivityTimeMs = now;
+                }
+            }
+        }
+
+        PltUnlockMutex(&reactorMutex);
+    }
+}
+
+// Starts servicing the handler's socket on the reactor thread. The first ping
+// is sent immediately. The reactor thread is started with the first handler.
+int addRtpReactorHandler(PRTP_REACTOR_HANDLER handler) {
+    int err;
+
+    LC_ASSERT(handler->socket != INVALID_SOCKET);
+
+    // Use a non-blocking socket so we can drain all pending datagrams on
+    // each wakeup. If we can't, we must only read once per readable event.
+    if (setSocketNonBlocking(handler->socket, 1) == SOCKET_ERROR) {
+        handler->maxBatchSize = 1;
+    }
+    else {
+        handler->maxBatchSize = MAX_RECEIVE_BATCH;
+    }
+
+    handler->nextPingTimeMs = 0;
+    handler->lastActivityTimeMs = PltGetMillis();
+    handler->failed = 0;
+
+    if (handlerCount == 0) {
+        err = PltCreateMutex(&reactorMutex);
+        if (err != 0) {
+            return err;
+        }
+
+        handlers[handlerCount++] = handler;
+        handlerGeneration++;
+
+        err = PltCreateThread("RtpReactor", ReactorThreadProc, NULL, &reactorThread);
+        if (err != 0) {
+            handlerCount = 0;
+            PltDeleteMutex(&reactorMutex);
+            return err;
+        }
+    }
+    else {
+        PltLockMutex(&reactorMutex);
+        LC_ASSERT(handlerCount < MAX_HANDLERS);
+        handlers[handlerCount++] = handler;
+        handlerGeneration++;
+        PltUnlockMutex(&reactorMutex);
+    }
+
+    return 0;
+}
+
+// Stops servicing the handler's socket. No handler callbacks are running or
+// will run after this returns. The reactor thread exits with the last handler.
+void removeRtpReactorHandler(PRTP_REACTOR_HANDLER handler) {
+    int remainingHandlers;
+    int i;
+
+    PltLockMutex(&reactorMutex);
+    for (i = 0; i < handlerCount; i++) {
+        if (handlers[i] == handler) {
+            handlers[i] = handlers[handlerCount - 1];
+            handlerCount--;
+            handlerGeneration++;
+            break;
+        }
+    }
+    remainingHandlers = handlerCount;
+    PltUnlockMutex(&reactorMutex);
+
+    if (remainingHandlers == 0) {
+        PltInterruptThread(&reactorThread);
+        PltJoinThread(&reactorThread);
+        PltCloseThread(&reactorThread);
+        PltDeleteMutex(&reactorMutex);
+    }
+}
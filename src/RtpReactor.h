@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Platform.h"
+#include "PlatformSockets.h"
+
+typedef struct _RTP_REACTOR_HANDLER {
+    // Socket to service
+    SOCKET socket;
+
+    // Reads up to maxPackets datagrams from the socket. Returns a negative
+    // value if the connection was terminated and the socket must no longer
+    // be serviced.
+    int (*receive)(int maxPackets);
+
+    // Invoked after UDP_RECV_POLL_TIMEOUT_MS elapses without data on the socket.
+    // Returns a negative value if the connection was terminated.
+    int (*timeout)(void);
+
+    // Sends a UDP ping to the host. Returns a negative value if the
+    // connection was terminated.
+    int (*ping)(void);
+
+    // Optional. Handles any time-sensitive work that is due at the given time
+    // and returns the number of milliseconds until more will be due, or -1 if
+    // none is pending. The reactor won't wait on the socket past that deadline.
+    int (*serviceDeadlines)(uint64_t now);
+
+    // Internal state owned by the reactor
+    uint64_t nextPingTimeMs;
+    uint64_t lastActivityTimeMs;
+    int maxBatchSize;
+    int failed;
+} RTP_REACTOR_HANDLER, *PRTP_REACTOR_HANDLER;
+
+int addRtpReactorHandler(PRTP_REACTOR_HANDLER handler);
+void removeRtpReactorHandler(PRTP_REACTOR_HANDLER handler);
@@ -1,113 +1,180 @@
 #include "Limelight-internal.h"
 #include "RtpReorderQueue.h"
 
+// Interarrival jitter is tracked as in RFC 3550 with a gain of 1/16
+#define JITTER_SCALE 16
+
+// The target queue time is this many multiples of the measured jitter
+#define JITTER_MULTIPLIER 3
+
+// If no reordering is seen for this long, the reorder allowance shrinks
+// by one packet duration
+#define REORDER_DECAY_INTERVAL_MS 1000
+
+#define RING_INDEX(seq) ((seq) & (RTPQ_RING_SIZE - 1))
+
+// Returns the index of the lowest set bit in a non-zero mask
+static int lowestSetBit(uint64_t mask) {
+    LC_ASSERT(mask != 0);
+
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+#else
+    int index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
 void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, int maxSize, int maxQueueTimeMs) {
     memset(queue, 0, sizeof(*queue));
     queue->maxSize = maxSize;
     queue->maxQueueTimeMs = maxQueueTimeMs;
     queue->nextRtpSequenceNumber = UINT16_MAX;
-    queue->oldestQueuedTimeMs = UINT64_MAX;
+
+    LC_ASSERT(maxSize <= RTPQ_RING_SIZE);
 }
 
-void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue) {
-    while (queue->queueHead != NULL) {
-        PRTP_QUEUE_ENTRY entry = queue->queueHead;
-        queue->queueHead = entry->next;
-        free(entry->packet);
-    }
+// Size the queue from the measured jitter and reordering instead of using
+// the fixed limits. The queue time will shrink during calm periods to avoid
+// adding latency when packets are lost, and grow when packets are arriving
+// late or out of order to avoid needless concealment.
+void RtpqEnableAdaptiveQueueTime(PRTP_REORDER_QUEUE queue, int packetDurationMs) {
+    LC_ASSERT(packetDurationMs > 0);
+
+    queue->packetDurationMs = packetDurationMs;
+    queue->maxSizeLimit = queue->maxSize;
+    queue->maxQueueTimeLimitMs = queue->maxQueueTimeMs;
+    queue->lastArrivalTimeMs = 0;
+    queue->scaledJitterMs = 0;
+    queue->reorderDelayMs = 0;
 }
 
-// newEntry is contained within the packet buffer so we free the whole entry by freeing entry->packet
-static int queuePacket(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY newEntry, int head, PRTP_PACKET packet) {
-    PRTP_QUEUE_ENTRY entry;
+static void updateAdaptiveQueueTime(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, uint64_t now) {
+    int targetMs;
 
-    LC_ASSERT(!isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber));
+    if (queue->lastArrivalTimeMs == 0) {
+        queue->lastArrivalSequenceNumber = queue->highestSequenceNumber = packet->sequenceNumber;
+        queue->lastArrivalTimeMs = queue->lastReorderTimeMs = now;
+        return;
+    }
 
-    // Don't queue duplicates
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (entry->packet->sequenceNumber == packet->sequenceNumber) {
-            return 0;
+    if (isBefore16(packet->sequenceNumber, queue->highestSequenceNumber)) {
+        // This packet arrived out of order. We would have needed to wait
+        // for this many packets to avoid concealing it.
+        int delayMs = U16(queue->highestSequenceNumber - packet->sequenceNumber) * queue->packetDurationMs;
+        if (delayMs > queue->reorderDelayMs) {
+            queue->reorderDelayMs = delayMs;
         }
-
-        entry = entry->next;
+        queue->lastReorderTimeMs = now;
     }
+    else {
+        // Compare the arrival spacing to the expected spacing
+        int expectedMs = U16(packet->sequenceNumber - queue->lastArrivalSequenceNumber) * queue->packetDurationMs;
+        int deviationMs = (int)(now - queue->lastArrivalTimeMs) - expectedMs;
 
-    newEntry->packet = packet;
-    newEntry->queueTimeMs = PltGetMillis();
-    newEntry->prev = NULL;
-    newEntry->next = NULL;
+        if (deviationMs < 0) {
+            deviationMs = -deviationMs;
+        }
+        queue->scaledJitterMs += deviationMs - (queue->scaledJitterMs + JITTER_SCALE / 2) / JITTER_SCALE;
 
-    if (queue->oldestQueuedTimeMs == UINT64_MAX) {
-        queue->oldestQueuedTimeMs = newEntry->queueTimeMs;
+        queue->highestSequenceNumber = packet->sequenceNumber;
+        queue->lastArrivalSequenceNumber = packet->sequenceNumber;
+        queue->lastArrivalTimeMs = now;
+
+        if (now - queue->lastReorderTimeMs >= REORDER_DECAY_INTERVAL_MS) {
+            queue->reorderDelayMs -= queue->packetDurationMs;
+            if (queue->reorderDelayMs < 0) {
+                queue->reorderDelayMs = 0;
+            }
+            queue->lastReorderTimeMs = now;
+        }
     }
 
-    if (queue->queueHead == NULL) {
-        LC_ASSERT(queue->queueSize == 0);
-        queue->queueHead = queue->queueTail = newEntry;
+    targetMs = JITTER_MULTIPLIER * queue->scaledJitterMs / JITTER_SCALE;
+    if (queue->reorderDelayMs > targetMs) {
+        targetMs = queue->reorderDelayMs;
     }
-    else if (head) {
-        LC_ASSERT(queue->queueSize > 0);
-        PRTP_QUEUE_ENTRY oldHead = queue->queueHead;
-        newEntry->next = oldHead;
-        LC_ASSERT(oldHead->prev == NULL);
-        oldHead->prev = newEntry;
-        queue->queueHead = newEntry;
+    targetMs += queue->packetDurationMs;
+
+    if (targetMs < 2 * queue->packetDurationMs) {
+        targetMs = 2 * queue->packetDurationMs;
     }
-    else {
-        LC_ASSERT(queue->queueSize > 0);
-        PRTP_QUEUE_ENTRY oldTail = queue->queueTail;
-        newEntry->prev = oldTail;
-        LC_ASSERT(oldTail->next == NULL);
-        oldTail->next = newEntry;
-        queue->queueTail = newEntry;
+    if (targetMs > queue->maxQueueTimeLimitMs) {
+        targetMs = queue->maxQueueTimeLimitMs;
     }
-    queue->queueSize++;
 
-    return 1;
-}
+    queue->maxQueueTimeMs = targetMs;
 
-static void updateOldestQueued(PRTP_REORDER_QUEUE queue) {
-    PRTP_QUEUE_ENTRY entry;
-
-    queue->oldestQueuedTimeMs = UINT64_MAX;
+    // Leave room for the packets that arrive while we wait for a missing one
+    queue->maxSize = targetMs / queue->packetDurationMs + 2;
+    if (queue->maxSize > queue->maxSizeLimit) {
+        queue->maxSize = queue->maxSizeLimit;
+    }
+}
 
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (entry->queueTimeMs < queue->oldestQueuedTimeMs) {
-            queue->oldestQueuedTimeMs = entry->queueTimeMs;
-        }
+// Returns the smoothed interarrival jitter in milliseconds. This is only
+// measured once adaptive sizing is enabled.
+int RtpqGetJitterMs(PRTP_REORDER_QUEUE queue) {
+    return (queue->scaledJitterMs + JITTER_SCALE / 2) / JITTER_SCALE;
+}
 
-        entry = entry->next;
-    }
+// Packets are owned by the caller, so this only forgets them
+void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue) {
+    memset(queue->slots, 0, sizeof(queue->slots));
+    queue->occupancy = 0;
+    queue->queueHead = queue->queueTail = NULL;
+    queue->queueSize = 0;
 }
 
-static PRTP_QUEUE_ENTRY getEntryByLowestSeq(PRTP_REORDER_QUEUE queue) {
-    PRTP_QUEUE_ENTRY lowestSeqEntry, entry;
+// Queued packets are stored in the ring slot for their sequence number and
+// linked in arrival order, so the head of the list is the oldest packet.
+// newEntry is contained within the packet buffer.
+static int queuePacket(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY newEntry, PRTP_PACKET packet, uint64_t now) {
+    int index = RING_INDEX(packet->sequenceNumber);
 
-    lowestSeqEntry = queue->queueHead;
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (isBefore16(entry->packet->sequenceNumber, lowestSeqEntry->packet->sequenceNumber)) {
-            lowestSeqEntry = entry;
-        }
+    LC_ASSERT(!isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber));
+    LC_ASSERT(U16(packet->sequenceNumber - queue->nextRtpSequenceNumber) < RTPQ_RING_SIZE);
 
-        entry = entry->next;
+    // Don't queue duplicates
+    if (queue->occupancy & (1ULL << index)) {
+        return 0;
     }
 
-    // Remember the updated lowest sequence number
-    if (lowestSeqEntry != NULL) {
-        queue->nextRtpSequenceNumber = lowestSeqEntry->packet->sequenceNumber;
+    newEntry->packet = packet;
+    newEntry->queueTimeMs = now;
+    newEntry->next = NULL;
+    newEntry->prev = queue->queueTail;
+
+    if (queue->queueTail == NULL) {
+        LC_ASSERT(queue->queueSize == 0);
+        queue->queueHead = newEntry;
+    }
+    else {
+        LC_ASSERT(queue->queueSize > 0);
+        queue->queueTail->next = newEntry;
     }
+    queue->queueTail = newEntry;
+
+    queue->slots[index] = newEntry;
+    queue->occupancy |= 1ULL << index;
+    queue->queueSize++;
 
-    return lowestSeqEntry;
+    return 1;
 }
 
 static void removeEntry(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY entry) {
-    LC_ASSERT(entry != NULL);
+    int index = RING_INDEX(entry->packet->sequenceNumber);
+
     LC_ASSERT(queue->queueSize > 0);
-    LC_ASSERT(queue->queueHead != NULL);
-    LC_ASSERT(queue->queueTail != NULL);
+    LC_ASSERT(queue->slots[index] == entry);
 
     if (queue->queueHead == entry) {
         queue->queueHead = entry->next;
@@ -122,19 +189,39 @@ static void removeEntry(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY entry) {
     if (entry->next != NULL) {
         entry->next->prev = entry->prev;
     }
+
+    queue->slots[index] = NULL;
+    queue->occupancy &= ~(1ULL << index);
     queue->queueSize--;
 }
 
-static PRTP_QUEUE_ENTRY enforceQueueConstraints(PRTP_REORDER_QUEUE queue) {
+// Skips the missing packets ahead of the lowest queued sequence number
+static void skipToLowestSeq(PRTP_REORDER_QUEUE queue) {
+    int start = RING_INDEX(queue->nextRtpSequenceNumber);
+    uint64_t rotated;
+
+    LC_ASSERT(queue->occupancy != 0);
+
+    // Rotate the bitmap so bit 0 is the next sequence number
+    rotated = queue->occupancy >> start;
+    if (start != 0) {
+        rotated |= queue->occupancy << (RTPQ_RING_SIZE - start);
+    }
+
+    queue->nextRtpSequenceNumber += lowestSetBit(rotated);
+}
+
+// Returns 1 if the constraints were enforced by skipping to the lowest queued packet
+static int enforceQueueConstraints(PRTP_REORDER_QUEUE queue, uint64_t now) {
     int dequeuePacket = 0;
 
     // Empty queue is fine
     if (queue->queueHead == NULL) {
-        return NULL;
+        return 0;
     }
 
     // Check that the queue's time constraint is satisfied
-    if (PltGetMillis() - queue->oldestQueuedTimeMs > queue->maxQueueTimeMs) {
+    if (now - queue->queueHead->queueTimeMs > queue->maxQueueTimeMs) {
         Limelog("Returning RTP packet queued for too long\n");
         dequeuePacket = 1;
     }
@@ -142,21 +229,27 @@ static PRTP_QUEUE_ENTRY enforceQueueConstraints(PRTP_REORDER_QUEUE queue) {
     // Check that the queue's size constraint is satisfied. We subtract one
     // because this is validating that the queue will meet constraints _after_
     // the current packet is enqueued.
-    if (!dequeuePacket && queue->queueSize == queue->maxSize - 1) {
+    if (!dequeuePacket && queue->queueSize >= queue->maxSize - 1) {
         Limelog("Returning RTP packet after queue overgrowth\n");
         dequeuePacket = 1;
     }
 
     if (dequeuePacket) {
-        // Return the lowest seq queued
-        return getEntryByLowestSeq(queue);
-    }
-    else {
-        return NULL;
+        skipToLowestSeq(queue);
     }
+
+    return dequeuePacket;
 }
 
-int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry) {
+// now is the time the packet was received in milliseconds. Callers handling
+// a batch of packets may pass the same time for all of them.
+int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry, uint64_t now) {
+    int lowestReady;
+
+    if (queue->packetDurationMs != 0) {
+        updateAdaptiveQueueTime(queue, packet, now);
+    }
+
     if (queue->nextRtpSequenceNumber != UINT16_MAX &&
         isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber)) {
         // Reject packets behind our current sequence number
@@ -164,15 +257,18 @@ int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY
     }
 
     if (queue->queueHead == NULL) {
-        // Return immediately for an exact match with an empty queue
+        // Return immediately for an exact match with an empty queue. If the
+        // packet is too far ahead for the ring, the missing packets are so
+        // old that there's no point waiting for them.
         if (queue->nextRtpSequenceNumber == UINT16_MAX ||
-            packet->sequenceNumber == queue->nextRtpSequenceNumber) {
+            packet->sequenceNumber == queue->nextRtpSequenceNumber ||
+            U16(packet->sequenceNumber - queue->nextRtpSequenceNumber) >= RTPQ_RING_SIZE) {
             queue->nextRtpSequenceNumber = packet->sequenceNumber + 1;
             return RTPQ_RET_HANDLE_NOW;
         }
         else {
             // Queue is empty currently so we'll put this packet on there
-            if (!queuePacket(queue, packetEntry, 0, packet)) {
+            if (!queuePacket(queue, packetEntry, packet, now)) {
                 return 0;
             }
             else {
@@ -180,77 +276,57 @@ int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY
             }
         }
     }
-    else {
-        PRTP_QUEUE_ENTRY lowestEntry;
-
-        // Validate that the queue remains within our contraints
-        // and get the lowest element
-        lowestEntry = enforceQueueConstraints(queue);
 
-        // If the queue is now empty after validating queue constraints,
-        // this packet can be returned immediately
-        if (lowestEntry == NULL && queue->queueHead == NULL) {
-            queue->nextRtpSequenceNumber = packet->sequenceNumber + 1;
-            return RTPQ_RET_HANDLE_NOW;
-        }
-        else if (lowestEntry != NULL && queue->nextRtpSequenceNumber != UINT16_MAX &&
-                 isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber)) {
-            // The queue constraints were enforced and a new lowest entry was
-            // made available for retrieval. This packet was behind the new lowest
-            // so it will not be consumed by the queue.
-            return RTPQ_RET_PACKET_READY;
-        }
+    // Validate that the queue remains within our contraints
+    // and make the lowest element available
+    lowestReady = enforceQueueConstraints(queue, now);
 
-        // Queue has data inside, so we need to see where this packet fits
-        if (packet->sequenceNumber == queue->nextRtpSequenceNumber) {
-            // It fits in a hole where we need a packet, now we have some ready
-            if (!queuePacket(queue, packetEntry, 0, packet)) {
-                return 0;
-            }
-            else {
-                return RTPQ_RET_PACKET_READY | RTPQ_RET_PACKET_CONSUMED;
-            }
-        }
-        else {
-            if (!queuePacket(queue, packetEntry, 0, packet)) {
-                return 0;
-            }
-            else {
-                // Constraint validation may have changed the oldest packet to one that
-                // matches the next sequence number
-                return RTPQ_RET_PACKET_CONSUMED | ((lowestEntry != NULL) ? RTPQ_RET_PACKET_READY : 0);
-            }
-        }
+    if (!lowestReady && U16(packet->sequenceNumber - queue->nextRtpSequenceNumber) >= RTPQ_RING_SIZE) {
+        // This packet is too far ahead to fit in the ring, so stop waiting
+        // for the missing packets and return what we have
+        skipToLowestSeq(queue);
+        lowestReady = 1;
     }
-}
 
-PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue) {
-    PRTP_QUEUE_ENTRY queuedEntry, entry;
-
-    // Find the next queued packet
-    queuedEntry = NULL;
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (entry->packet->sequenceNumber == queue->nextRtpSequenceNumber) {
-            queue->nextRtpSequenceNumber++;
-            queuedEntry = entry;
-            removeEntry(queue, entry);
-            break;
-        }
+    if (U16(packet->sequenceNumber - queue->nextRtpSequenceNumber) >= RTPQ_RING_SIZE) {
+        // Still too far ahead, so this packet is dropped rather than queued
+        return RTPQ_RET_PACKET_READY;
+    }
+    else if (lowestReady && isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber)) {
+        // The queue constraints were enforced and a new lowest entry was
+        // made available for retrieval. This packet was behind the new lowest
+        // so it will not be consumed by the queue.
+        return RTPQ_RET_PACKET_READY;
+    }
 
-        entry = entry->next;
+    if (!queuePacket(queue, packetEntry, packet, now)) {
+        return 0;
+    }
+    else if (packet->sequenceNumber == queue->nextRtpSequenceNumber) {
+        // It fits in a hole where we need a packet, now we have some ready
+        return RTPQ_RET_PACKET_READY | RTPQ_RET_PACKET_CONSUMED;
+    }
+    else {
+        // Constraint validation may have changed the oldest packet to one that
+        // matches the next sequence number
+        return RTPQ_RET_PACKET_CONSUMED | (lowestReady ? RTPQ_RET_PACKET_READY : 0);
     }
+}
 
-    // Bail if we found nothing
-    if (queuedEntry == NULL) {
-        // Update the oldest queued packet time
-        updateOldestQueued(queue);
+PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue) {
+    PRTP_QUEUE_ENTRY entry;
+    int index = RING_INDEX(queue->nextRtpSequenceNumber);
 
+    // Bail if the next packet hasn't arrived
+    if ((queue->occupancy & (1ULL << index)) == 0) {
         return NULL;
     }
 
-    // We don't update the oldest queued entry here, because we know
-    // the caller will call again until it receives null
+    entry = queue->slots[index];
+    LC_ASSERT(entry->packet->sequenceNumber == queue->nextRtpSequenceNumber);
+
+    removeEntry(queue, entry);
+    queue->nextRtpSequenceNumber++;
 
-    return queuedEntry->packet;
-}
\ No newline at end of file
+    return entry->packet;
+}
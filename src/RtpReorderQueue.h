@@ -5,6 +5,10 @@
 #define RTPQ_DEFAULT_MAX_SIZE   16
 #define RTPQ_DEFAULT_QUEUE_TIME 40
 
+// Queued packets must be within this many sequence numbers of the next
+// expected packet. This must be 64 to match the occupancy bitmap.
+#define RTPQ_RING_SIZE 64
+
 typedef struct _RTP_QUEUE_ENTRY {
     PRTP_PACKET packet;
 
@@ -18,13 +22,28 @@ typedef struct _RTP_REORDER_QUEUE {
     int maxSize;
     int maxQueueTimeMs;
 
+    // Queued entries indexed by sequence number
+    PRTP_QUEUE_ENTRY slots[RTPQ_RING_SIZE];
+    uint64_t occupancy;
+
+    // Queued entries in arrival order
     PRTP_QUEUE_ENTRY queueHead;
     PRTP_QUEUE_ENTRY queueTail;
     int queueSize;
 
     unsigned short nextRtpSequenceNumber;
 
-    uint64_t oldestQueuedTimeMs;
+    // Adaptive sizing state. The limits passed to RtpqInitializeQueue()
+    // become upper bounds once adaptive sizing is enabled.
+    int packetDurationMs;
+    int maxSizeLimit;
+    int maxQueueTimeLimitMs;
+    unsigned short lastArrivalSequenceNumber;
+    unsigned short highestSequenceNumber;
+    uint64_t lastArrivalTimeMs;
+    int scaledJitterMs;
+    int reorderDelayMs;
+    uint64_t lastReorderTimeMs;
 } RTP_REORDER_QUEUE, *PRTP_REORDER_QUEUE;
 
 #define RTPQ_RET_PACKET_CONSUMED 0x1
@@ -36,6 +55,8 @@ typedef struct _RTP_REORDER_QUEUE {
 #define RTPQ_HANDLE_NOW(x)      ((x) == RTPQ_RET_HANDLE_NOW)
 
 void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, int maxSize, int maxQueueTimeMs);
+void RtpqEnableAdaptiveQueueTime(PRTP_REORDER_QUEUE queue, int packetDurationMs);
+int RtpqGetJitterMs(PRTP_REORDER_QUEUE queue);
 void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue);
-int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry);
+int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry, uint64_t now);
 PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue);
\ No newline at end of file
@@ -297,12 +297,19 @@ Exit:
 }
 
 static int transactRtspMessage(PRTSP_MESSAGE request, PRTSP_MESSAGE response, int expectingPayload, int* error) {
+    uint64_t startTimeMs = PltGetMillis();
+    int ret;
+
     if (useEnet) {
-        return transactRtspMessageEnet(request, response, expectingPayload, error);
+        ret = transactRtspMessageEnet(request, response, expectingPayload, error);
     }
     else {
-        return transactRtspMessageTcp(request, response, expectingPayload, error);
+        ret = transactRtspMessageTcp(request, response, expectingPayload, error);
     }
+
+    connectionRecordRtspRequestTime(request->message.request.command, (unsigned int)(PltGetMillis() - startTimeMs));
+
+    return ret;
 }
 
 // Send RTSP OPTIONS request
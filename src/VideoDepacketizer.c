@@ -259,6 +259,9 @@ static void reassembleFrame(int frameNumber) {
         }
 
         if (qdu != NULL) {
+            int isIdrFrame;
+            uint64_t receiveTimeMs;
+
             qdu->decodeUnit.bufferList = nalChainHead;
             qdu->decodeUnit.fullLength = nalChainDataLength;
             qdu->decodeUnit.frameNumber = frameNumber;
@@ -273,6 +276,10 @@ static void reassembleFrame(int frameNumber) {
                 qdu->decodeUnit.frameType = FRAME_TYPE_PFRAME;
             }
 
+            // The queued DU may be freed by the decoder before we're done here
+            isIdrFrame = qdu->decodeUnit.frameType == FRAME_TYPE_IDR;
+            receiveTimeMs = qdu->decodeUnit.receiveTimeMs;
+
             nalChainHead = nalChainTail = NULL;
             nalChainDataLength = 0;
 
@@ -302,7 +309,7 @@ static void reassembleFrame(int frameNumber) {
             }
 
             // Notify the control connection
-            connectionReceivedCompleteFrame(frameNumber);
+            connectionReceivedCompleteFrame(frameNumber, isIdrFrame, receiveTimeMs);
 
             // Clear frame drops
             consecutiveFrameDrops = 0;
@@ -2,6 +2,7 @@
 #include "PlatformSockets.h"
 #include "PlatformThreads.h"
 #include "RtpFecQueue.h"
+#include "RtpReactor.h"
 
 #define FIRST_FRAME_MAX 1500
 #define FIRST_FRAME_TIMEOUT_SEC 10
@@ -11,6 +12,9 @@
 
 #define RTP_RECV_BUFFER (512 * 1024)
 
+// Granularity of the receive timeout while waiting for an RTP queue deadline
+#define RECV_TIMEOUT_STEP_MS 5
+
 static RTP_FEC_QUEUE rtpQueue;
 
 static SOCKET rtpSocket = INVALID_SOCKET;
@@ -21,9 +25,18 @@ static PLT_THREAD receiveThread;
 static PLT_THREAD decoderThread;
 
 static int receivedDataFromPeer;
+static int waitingForVideoMs;
 static uint64_t firstDataTimeMs;
 static int receivedFullFrame;
 
+// Receive buffer not yet owned by the FEC queue
+static char* receiveBuffer;
+
+static RTP_REACTOR_HANDLER reactorHandler;
+
+// When the RTP queue's next deadline is due, or 0 if it has none
+static uint64_t nextDeadlineTimeMs;
+
 // We can't request an IDR frame until the depacketizer knows
 // that a packet was lost. This timeout bounds the time that
 // the RTP queue will wait for missing/reordered packets.
@@ -33,20 +46,24 @@ static int receivedFullFrame;
 // Initialize the video stream
 void initializeVideoStream(void) {
     initializeVideoDepacketizer(StreamConfig.packetSize);
-    RtpfInitializeQueue(&rtpQueue); //TODO RTP_QUEUE_DELAY
+    RtpfInitializeQueue(&rtpQueue, RTP_QUEUE_DELAY);
+    initializeConnectionQuality();
     receivedDataFromPeer = 0;
+    waitingForVideoMs = 0;
     firstDataTimeMs = 0;
     receivedFullFrame = 0;
+    nextDeadlineTimeMs = 0;
 }
 
 // Clean up the video stream
 void destroyVideoStream(void) {
     destroyVideoDepacketizer();
     RtpfCleanupQueue(&rtpQueue);
+    destroyConnectionQuality();
 }
 
-// UDP Ping proc
-static void UdpPingThreadProc(void* context) {
+// Send a UDP ping to the host so it knows where to send video
+static int sendVideoPing(void) {
     char pingData[] = { 0x50, 0x49, 0x4E, 0x47 };
     struct sockaddr_in6 saddr;
     SOCK_RET err;
@@ -54,11 +71,20 @@ static void UdpPingThreadProc(void* context) {
     memcpy(&saddr, &RemoteAddr, sizeof(saddr));
     saddr.sin6_port = htons(RTP_PORT);
 
+    err = sendto(rtpSocket, pingData, sizeof(pingData), 0, (struct sockaddr*)&saddr, RemoteAddrLen);
+    if (err != sizeof(pingData)) {
+        Limelog("Video Ping: send() failed: %d\n", (int)LastSocketError());
+        ListenerCallbacks.connectionTerminated(LastSocketFail());
+        return -1;
+    }
+
+    return 0;
+}
+
+// UDP Ping proc
+static void UdpPingThreadProc(void* context) {
     while (!PltIsThreadInterrupted(&udpPingThread)) {
-        err = sendto(rtpSocket, pingData, sizeof(pingData), 0, (struct sockaddr*)&saddr, RemoteAddrLen);
-        if (err != sizeof(pingData)) {
-            Limelog("Video Ping: send() failed: %d\n", (int)LastSocketError());
-            ListenerCallbacks.connectionTerminated(LastSocketFail());
+        if (sendVideoPing() < 0) {
             return;
         }
 
@@ -66,20 +92,118 @@ static void UdpPingThreadProc(void* context) {
     }
 }
 
-// Receive thread proc
-static void ReceiveThreadProc(void* context) {
+// Reads a single datagram from the RTP socket and passes it to the FEC queue.
+// Returns the size of the datagram, 0 if no data was received, or -1 if the
+// connection was terminated.
+static int receiveVideoPacket(int useSelect, int timeoutMs) {
     int err;
-    int bufferSize, receiveSize;
-    char* buffer;
+    int receiveSize;
     int queueStatus;
-    int useSelect;
-    int waitingForVideoMs;
+    PRTP_PACKET packet;
 
     receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
-    bufferSize = receiveSize + sizeof(RTPFEC_QUEUE_ENTRY);
-    buffer = NULL;
 
-    if (setNonFatalRecvTimeoutMs(rtpSocket, UDP_RECV_POLL_TIMEOUT_MS) < 0) {
+    if (receiveBuffer == NULL) {
+        receiveBuffer = (char*)malloc(receiveSize + sizeof(RTPFEC_QUEUE_ENTRY));
+        if (receiveBuffer == NULL) {
+            Limelog("Video Receive: malloc() failed\n");
+            ListenerCallbacks.connectionTerminated(-1);
+            return -1;
+        }
+    }
+
+    err = recvUdpSocketWithTimeout(rtpSocket, receiveBuffer, receiveSize, useSelect, timeoutMs);
+    if (err < 0) {
+        Limelog("Video Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
+        ListenerCallbacks.connectionTerminated(LastSocketFail());
+        return -1;
+    }
+    else if (err == 0) {
+        return 0;
+    }
+
+    if (!receivedDataFromPeer) {
+        receivedDataFromPeer = 1;
+        Limelog("Received first video packet after %d ms\n", waitingForVideoMs);
+
+        firstDataTimeMs = PltGetMillis();
+        connectionReceivedFirstVideoPacket();
+    }
+
+    if (!receivedFullFrame) {
+        uint64_t now = PltGetMillis();
+
+        if (now - firstDataTimeMs >= FIRST_FRAME_TIMEOUT_SEC * 1000) {
+            Limelog("Terminating connection due to lack of a successful video frame\n");
+            ListenerCallbacks.connectionTerminated(ML_ERROR_NO_VIDEO_FRAME);
+            return -1;
+        }
+    }
+
+    // Convert fields to host byte-order
+    packet = (PRTP_PACKET)&receiveBuffer[0];
+    packet->sequenceNumber = htons(packet->sequenceNumber);
+    packet->timestamp = htonl(packet->timestamp);
+    packet->ssrc = htonl(packet->ssrc);
+
+    queueStatus = RtpfAddPacket(&rtpQueue, packet, err, (PRTPFEC_QUEUE_ENTRY)&receiveBuffer[receiveSize]);
+
+    if (queueStatus == RTPF_RET_QUEUED) {
+        // The queue owns the buffer
+        receiveBuffer = NULL;
+    }
+
+    return err;
+}
+
+// Releases held packets whose reorder deadline has passed and abandons a
+// stalled frame. Returns the number of milliseconds until the RTP queue's
+// next deadline, or -1 if there is none. The queue is left alone until the
+// cached deadline passes or a new deadline is added.
+static int serviceVideoDeadlines(uint64_t now) {
+    int deadlineMs;
+
+    if (!RtpfHasNewDeadline(&rtpQueue) &&
+            (nextDeadlineTimeMs == 0 || now < nextDeadlineTimeMs)) {
+        return nextDeadlineTimeMs != 0 ? (int)(nextDeadlineTimeMs - now) : -1;
+    }
+
+    RtpfReleaseExpiredPackets(&rtpQueue);
+    RtpfAbandonStalledFrame(&rtpQueue, now);
+
+    deadlineMs = RtpfGetNextDeadlineMs(&rtpQueue, now);
+    nextDeadlineTimeMs = deadlineMs >= 0 ? now + deadlineMs : 0;
+    return deadlineMs;
+}
+
+// Called after UDP_RECV_POLL_TIMEOUT_MS without video data. Returns -1 if
+// the connection was terminated.
+static int handleVideoReceiveTimeout(void) {
+    if (!receivedDataFromPeer) {
+        // If we wait many seconds without ever receiving a video packet,
+        // assume something is broken and terminate the connection.
+        waitingForVideoMs += UDP_RECV_POLL_TIMEOUT_MS;
+        if (waitingForVideoMs >= FIRST_FRAME_TIMEOUT_SEC * 1000) {
+            Limelog("Terminating connection due to lack of video traffic\n");
+            ListenerCallbacks.connectionTerminated(ML_ERROR_NO_VIDEO_TRAFFIC);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Receive thread proc
+static void ReceiveThreadProc(void* context) {
+    int err;
+    int useSelect;
+    int timeoutMs;
+    int nextTimeoutMs;
+    int deadlineMs;
+    int idleMs;
+
+    timeoutMs = UDP_RECV_POLL_TIMEOUT_MS;
+    if (setNonFatalRecvTimeoutMs(rtpSocket, timeoutMs) < 0) {
         // SO_RCVTIMEO failed, so use select() to wait
         useSelect = 1;
     }
@@ -88,75 +212,70 @@ static void ReceiveThreadProc(void* context) {
         useSelect = 0;
     }
 
-    waitingForVideoMs = 0;
+    idleMs = 0;
     while (!PltIsThreadInterrupted(&receiveThread)) {
-        PRTP_PACKET packet;
-
-        if (buffer == NULL) {
-            buffer = (char*)malloc(bufferSize);
-            if (buffer == NULL) {
-                Limelog("Video Receive: malloc() failed\n");
-                ListenerCallbacks.connectionTerminated(-1);
-                return;
-            }
-        }
-
-        err = recvUdpSocket(rtpSocket, buffer, receiveSize, useSelect);
+        err = receiveVideoPacket(useSelect, timeoutMs);
         if (err < 0) {
-            Limelog("Video Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
-            ListenerCallbacks.connectionTerminated(LastSocketFail());
             break;
         }
-        else if  (err == 0) {
-            if (!receivedDataFromPeer) {
-                // If we wait many seconds without ever receiving a video packet,
-                // assume something is broken and terminate the connection.
-                waitingForVideoMs += UDP_RECV_POLL_TIMEOUT_MS;
-                if (waitingForVideoMs >= FIRST_FRAME_TIMEOUT_SEC * 1000) {
-                    Limelog("Terminating connection due to lack of video traffic\n");
-                    ListenerCallbacks.connectionTerminated(ML_ERROR_NO_VIDEO_TRAFFIC);
+        else if (err > 0) {
+            idleMs = 0;
+
+            // Most packets don't add a deadline, so they don't need to
+            // sample the time or change the socket timeout.
+            if (!RtpfHasNewDeadline(&rtpQueue)) {
+                continue;
+            }
+        }
+        else {
+            // Receive timed out
+            idleMs += timeoutMs;
+            if (idleMs >= UDP_RECV_POLL_TIMEOUT_MS) {
+                if (handleVideoReceiveTimeout() < 0) {
                     break;
                 }
+                idleMs = 0;
             }
-            
-            // Receive timed out; try again
-            continue;
         }
 
-        if (!receivedDataFromPeer) {
-            receivedDataFromPeer = 1;
-            Limelog("Received first video packet after %d ms\n", waitingForVideoMs);
-
-            firstDataTimeMs = PltGetMillis();
+        // Wake up in time for the next receive timeout or RTP queue deadline
+        nextTimeoutMs = UDP_RECV_POLL_TIMEOUT_MS - idleMs;
+        deadlineMs = serviceVideoDeadlines(PltGetMillis());
+        if (deadlineMs >= 0 && deadlineMs < nextTimeoutMs) {
+            nextTimeoutMs = deadlineMs;
         }
 
-        if (!receivedFullFrame) {
-            uint64_t now = PltGetMillis();
+        // Round down so the timeout stays the same from one frame to the
+        // next. Waking up a little early is harmless. A zero timeout would
+        // block forever with SO_RCVTIMEO.
+        if (nextTimeoutMs >= RECV_TIMEOUT_STEP_MS) {
+            nextTimeoutMs -= nextTimeoutMs % RECV_TIMEOUT_STEP_MS;
+        }
+        else if (nextTimeoutMs < 1) {
+            nextTimeoutMs = 1;
+        }
 
-            if (now - firstDataTimeMs >= FIRST_FRAME_TIMEOUT_SEC * 1000) {
-                Limelog("Terminating connection due to lack of a successful video frame\n");
-                ListenerCallbacks.connectionTerminated(ML_ERROR_NO_VIDEO_FRAME);
-                break;
+        if (nextTimeoutMs != timeoutMs) {
+            if (!useSelect && setNonFatalRecvTimeoutMs(rtpSocket, nextTimeoutMs) < 0) {
+                useSelect = 1;
             }
+            timeoutMs = nextTimeoutMs;
         }
+    }
+}
 
-        // Convert fields to host byte-order
-        packet = (PRTP_PACKET)&buffer[0];
-        packet->sequenceNumber = htons(packet->sequenceNumber);
-        packet->timestamp = htonl(packet->timestamp);
-        packet->ssrc = htonl(packet->ssrc);
-
-        queueStatus = RtpfAddPacket(&rtpQueue, packet, err, (PRTPFEC_QUEUE_ENTRY)&buffer[receiveSize]);
+// Shared receive thread handler for the RTP socket
+static int receiveVideoPackets(int maxPackets) {
+    int err;
 
-        if (queueStatus == RTPF_RET_QUEUED) {
-            // The queue owns the buffer
-            buffer = NULL;
+    while (maxPackets-- > 0) {
+        err = receiveVideoPacket(0, 0);
+        if (err <= 0) {
+            return err;
         }
     }
 
-    if (buffer != NULL) {
-        free(buffer);
-    }
+    return 0;
 }
 
 void submitFrame(PQUEUED_DECODE_UNIT qdu) {
@@ -165,6 +284,9 @@ void submitFrame(PQUEUED_DECODE_UNIT qdu) {
     completeQueuedDecodeUnit(qdu, ret);
 
     // Remember that we got a full frame successfully
+    if (!receivedFullFrame) {
+        connectionReceivedFirstFrame();
+    }
     receivedFullFrame = 1;
 }
 
@@ -202,8 +324,13 @@ void stopVideoStream(void) {
     // Wake up client code that may be waiting on the decode unit queue
     stopVideoDepacketizer();
     
-    PltInterruptThread(&udpPingThread);
-    PltInterruptThread(&receiveThread);
+    if (StreamConfig.useSharedReceiveThread) {
+        removeRtpReactorHandler(&reactorHandler);
+    }
+    else {
+        PltInterruptThread(&udpPingThread);
+        PltInterruptThread(&receiveThread);
+    }
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         PltInterruptThread(&decoderThread);
     }
@@ -212,14 +339,18 @@ void stopVideoStream(void) {
         shutdownTcpSocket(firstFrameSocket);
     }
 
-    PltJoinThread(&udpPingThread);
-    PltJoinThread(&receiveThread);
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltJoinThread(&udpPingThread);
+        PltJoinThread(&receiveThread);
+    }
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         PltJoinThread(&decoderThread);
     }
 
-    PltCloseThread(&udpPingThread);
-    PltCloseThread(&receiveThread);
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltCloseThread(&udpPingThread);
+        PltCloseThread(&receiveThread);
+    }
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         PltCloseThread(&decoderThread);
     }
@@ -232,10 +363,42 @@ void stopVideoStream(void) {
         closeSocket(rtpSocket);
         rtpSocket = INVALID_SOCKET;
     }
+    if (receiveBuffer != NULL) {
+        free(receiveBuffer);
+        receiveBuffer = NULL;
+    }
 
     VideoCallbacks.cleanup();
 }
 
+// Stop the receive and decoder threads during startup
+static void stopStartupThreads(void) {
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltInterruptThread(&receiveThread);
+    }
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        PltInterruptThread(&decoderThread);
+    }
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltJoinThread(&receiveThread);
+    }
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        PltJoinThread(&decoderThread);
+    }
+    if (!StreamConfig.useSharedReceiveThread) {
+        PltCloseThread(&receiveThread);
+    }
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        PltCloseThread(&decoderThread);
+    }
+
+    // Free the buffer left behind by the receive thread
+    if (receiveBuffer != NULL) {
+        free(receiveBuffer);
+        receiveBuffer = NULL;
+    }
+}
+
 // Start the video stream
 int startVideoStream(void* rendererContext, int drFlags) {
     int err;
@@ -259,21 +422,27 @@ int startVideoStream(void* rendererContext, int drFlags) {
 
     VideoCallbacks.start();
 
-    err = PltCreateThread("VideoRecv", ReceiveThreadProc, NULL, &receiveThread);
-    if (err != 0) {
-        VideoCallbacks.stop();
-        closeSocket(rtpSocket);
-        VideoCallbacks.cleanup();
-        return err;
+    // The shared receive thread begins receiving once the ping handler
+    // is registered below
+    if (!StreamConfig.useSharedReceiveThread) {
+        err = PltCreateThread("VideoRecv", ReceiveThreadProc, NULL, &receiveThread);
+        if (err != 0) {
+            VideoCallbacks.stop();
+            closeSocket(rtpSocket);
+            VideoCallbacks.cleanup();
+            return err;
+        }
     }
 
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         err = PltCreateThread("VideoDec", DecoderThreadProc, NULL, &decoderThread);
         if (err != 0) {
             VideoCallbacks.stop();
-            PltInterruptThread(&receiveThread);
-            PltJoinThread(&receiveThread);
-            PltCloseThread(&receiveThread);
+            if (!StreamConfig.useSharedReceiveThread) {
+                PltInterruptThread(&receiveThread);
+                PltJoinThread(&receiveThread);
+                PltCloseThread(&receiveThread);
+            }
             closeSocket(rtpSocket);
             VideoCallbacks.cleanup();
             return err;
@@ -287,18 +456,7 @@ int startVideoStream(void* rendererContext, int drFlags) {
         if (firstFrameSocket == INVALID_SOCKET) {
             VideoCallbacks.stop();
             stopVideoDepacketizer();
-            PltInterruptThread(&receiveThread);
-            if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                PltInterruptThread(&decoderThread);
-            }
-            PltJoinThread(&receiveThread);
-            if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                PltJoinThread(&decoderThread);
-            }
-            PltCloseThread(&receiveThread);
-            if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                PltCloseThread(&decoderThread);
-            }
+            stopStartupThreads();
             closeSocket(rtpSocket);
             VideoCallbacks.cleanup();
             return LastSocketError();
@@ -307,22 +465,21 @@ int startVideoStream(void* rendererContext, int drFlags) {
 
     // Start pinging before reading the first frame so GFE knows where
     // to send UDP data
-    err = PltCreateThread("VideoPing", UdpPingThreadProc, NULL, &udpPingThread);
+    if (StreamConfig.useSharedReceiveThread) {
+        reactorHandler.socket = rtpSocket;
+        reactorHandler.receive = receiveVideoPackets;
+        reactorHandler.timeout = handleVideoReceiveTimeout;
+        reactorHandler.ping = sendVideoPing;
+        reactorHandler.serviceDeadlines = serviceVideoDeadlines;
+        err = addRtpReactorHandler(&reactorHandler);
+    }
+    else {
+        err = PltCreateThread("VideoPing", UdpPingThreadProc, NULL, &udpPingThread);
+    }
     if (err != 0) {
         VideoCallbacks.stop();
         stopVideoDepacketizer();
-        PltInterruptThread(&receiveThread);
-        if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-            PltInterruptThread(&decoderThread);
-        }
-        PltJoinThread(&receiveThread);
-        if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-            PltJoinThread(&decoderThread);
-        }
-        PltCloseThread(&receiveThread);
-        if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-            PltCloseThread(&decoderThread);
-        }
+        stopStartupThreads();
         closeSocket(rtpSocket);
         if (firstFrameSocket != INVALID_SOCKET) {
             closeSocket(firstFrameSocket);